@@ -0,0 +1,447 @@
+/* Keystroke replay benchmark. It runs the editor headless, on a virtual
+    terminal of a fixed size, and feeds it keys one at a time, each once the
+    editor has settled from the one before. For every key it times how long
+    the editor took to handle it and draw the next frame, and it reports the
+    50th and 99th percentile of that along with the bytes the frames took and
+    the allocations made per key.
+
+    Without arguments it runs canned workloads built from a C source file
+    (kilo.c unless one is given): typing into it, pasting a megabyte of it,
+    scrolling and searching through a copy of it blown up to 64 MB, editing
+    a 16 MB line, and opening a comment above lines of a few kilobytes.
+    With a file and a script it replays the script on the file instead, a
+    script being the raw bytes kilo reads from the terminal, as kept by
+    running it with KILO_RECORD=<script> set.
+
+    usage: bench/replay [source]
+           bench/replay <file> <script> [rows cols]
+*/
+#define KILO_NO_MAIN
+#include "../kilo.c"
+#include <sys/wait.h>
+
+
+/* allocation counting */
+// glibc's own allocator, which the versions below count calls to before passing them on
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *p, size_t size);
+
+long bench_allocs; // calls to malloc, calloc and realloc from any thread
+
+void *malloc(size_t size)
+{
+    __atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    __atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *p, size_t size)
+{
+    __atomic_add_fetch(&bench_allocs, 1, __ATOMIC_RELAXED);
+    return __libc_realloc(p, size);
+}
+
+
+/* scripts */
+struct benchKey // bytes the terminal sends for one key
+{
+    char *b;
+    int len;
+};
+
+struct benchScript
+{
+    struct benchKey *key;
+    int n, cap;
+};
+
+// function that returns a monotonic time in seconds
+double benchNow()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// function that adds a key sent as s[0..len) to a script 'times' times
+void benchAdd(struct benchScript *sc, const char *s, int len, int times)
+{
+    while(times-- > 0)
+    {
+        if(sc->n == sc->cap)
+        {
+            sc->cap = sc->cap ? sc->cap * 2 : 256;
+            sc->key = realloc(sc->key, sizeof(struct benchKey) * sc->cap);
+        }
+        sc->key[sc->n].b = malloc(len);
+        memcpy(sc->key[sc->n].b, s, len);
+        sc->key[sc->n++].len = len;
+    }
+}
+
+// function that adds a key given by its escape sequence or character
+void benchKeys(struct benchScript *sc, const char *s, int times)
+{
+    benchAdd(sc, s, strlen(s), times);
+}
+
+// function that types text a key at a time, line breaks as Enter
+void benchType(struct benchScript *sc, const char *s)
+{
+    for(; *s; s++)
+        benchAdd(sc, *s == '\n' ? "\r" : s, 1, 1);
+}
+
+// function that adds text sent as one bracketed paste
+void benchPaste(struct benchScript *sc, const char *s, int len)
+{
+    struct abuf ab = { NULL, 0, 0 };
+
+    abAppend(&ab, "\x1b[200~", 6);
+    abAppend(&ab, s, len);
+    abAppend(&ab, "\x1b[201~", 6);
+    benchAdd(sc, ab.b, ab.len, 1);
+    abFree(&ab);
+}
+
+/* function that splits recorded terminal input into keys the way the
+    editor decodes them: escape sequences and pastes stay whole */
+void benchSplit(struct benchScript *sc, const char *s, int len)
+{
+    int i = 0;
+
+    while(i < len)
+    {
+        int j = i + 1;
+        if(s[i] == '\x1b' && j < len && s[j] == '[')
+        {
+            // parameters up to the final byte, a paste up to its end
+            for(j++; j < len && s[j] >= 0x20 && s[j] <= 0x3f; j++)
+                ;
+            j = j < len ? j + 1 : len;
+            if(j - i == 6 && !memcmp(&s[i], "\x1b[200~", 6))
+            {
+                const char *end = memmem(&s[j], len - j, "\x1b[201~", 6);
+                j = end ? end - s + 6 : len;
+            }
+        }
+        else if(s[i] == '\x1b' && j < len && s[j] == 'O')
+        {
+            j = j + 1 < len ? j + 2 : len;
+        }
+        benchAdd(sc, &s[i], j - i, 1);
+        i = j;
+    }
+}
+
+
+/* replay */
+struct benchRun // where a replay is and what it measured
+{
+    struct benchScript *sc;
+    int at, off; // key being sent and how much of it went in
+    int timing; // the key at 'at' - 1 is being handled
+    int done; // the script ran out
+    int waiting; // the editor asked for the next key and did not get it yet
+    double sent, asked; // when the last key went in and when the editor first wanted another
+    double *lat; // seconds every key took
+    double settle; // seconds spent on background work between keys
+    long allocs, mark; // allocations made while keys were handled, and the count when the last went in
+    const char *name; // workload being replayed
+    double open; // seconds opening the file and drawing it took
+    long bytes; // bytes drawn before the first key
+};
+
+struct benchRun R;
+
+// function that the editor calls when it waits for a key, and when it is ready for one
+void benchKey(int next)
+{
+    double now = benchNow();
+    static struct benchKey esc = { "\x1b", 1 };
+
+    if(!next)
+    {
+        if(R.timing)
+        {
+            R.lat[R.at - 1] = now - R.sent;
+            R.timing = 0;
+            R.allocs += bench_allocs - R.mark;
+        }
+        // it may wake up for background work many times before it settles
+        if(!R.waiting)
+            R.asked = now;
+        R.waiting = 1;
+        return;
+    }
+    R.settle += now - R.asked;
+    R.waiting = 0;
+    R.off = 0;
+    // after the script, escape takes the editor out of any prompt it was left in
+    if(R.at == R.sc->n)
+    {
+        R.done = 1;
+        R.sc->key[R.sc->n] = esc;
+        return;
+    }
+    R.at++;
+    R.timing = 1;
+    R.mark = bench_allocs;
+    R.sent = benchNow();
+}
+
+// function that gives the editor the bytes of the key being sent
+int benchRead(unsigned char *buf, int len)
+{
+    struct benchKey *k = &R.sc->key[R.done ? R.sc->n : R.at - 1];
+
+    if(len > k->len - R.off)
+        len = k->len - R.off;
+    memcpy(buf, k->b + R.off, len);
+    R.off += len;
+    return len;
+}
+
+// function that orders latencies
+int benchCompare(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+// function that prints a line of results for the keys the editor handled
+void benchReport()
+{
+    int keys = R.timing ? R.at - 1 : R.at, n = keys ? keys : 1;
+
+    qsort(R.lat, keys, sizeof(double), benchCompare);
+    printf("%-8s %6d %9.2f %9.1f %9.1f %9.1f %9.1f %9.1f %9.2f\n", R.name, keys,
+            R.open * 1e3, R.lat[keys / 2] * 1e6, R.lat[keys * 99 / 100] * 1e6,
+            R.lat[n - 1] * 1e6, R.settle * 1e3,
+            (double)(E.replay->bytes - R.bytes) / n, (double)R.allocs / n);
+}
+
+/* function that replays a script on a file in a child process, so every run
+    starts from a fresh editor; a script that quits the editor ends early */
+void benchRun(const char *name, const char *file, struct benchScript *sc, int rows, int cols)
+{
+    fflush(stdout);
+    pid_t pid = fork();
+    if(pid != 0)
+    {
+        if(pid == -1)
+            die("fork");
+        waitpid(pid, NULL, 0);
+        return;
+    }
+
+    static struct editorReplay replay;
+    replay.rows = rows;
+    replay.cols = cols;
+    replay.key = benchKey;
+    replay.read = benchRead;
+    E.replay = &replay;
+    R.sc = sc;
+    R.name = name;
+    R.lat = calloc(sc->n + 1, sizeof(double));
+    // room for the escape sent after the script
+    sc->key = realloc(sc->key, sizeof(struct benchKey) * (sc->n + 1));
+
+    // opening the file and drawing the first frame is timed on its own
+    double t = benchNow();
+    initEditor();
+    editorOpen((char *)file);
+    editorRefreshScreen();
+    R.open = benchNow() - t;
+    R.bytes = replay.bytes;
+    atexit(benchReport);
+
+    while(!R.done)
+    {
+        if(editorInputPending())
+            editorScroll();
+        else
+            editorRefreshScreen();
+        editorProcessKeypress();
+    }
+    exit(0);
+}
+
+// function that empties a script
+void benchClear(struct benchScript *sc)
+{
+    for(int i = 0; i < sc->n; i++)
+        free(sc->key[i].b);
+    sc->n = 0;
+}
+
+// function that reads a whole file, setting 'len'
+char *benchSlurp(const char *path, size_t *len)
+{
+    struct stat st;
+    int fd = open(path, O_RDONLY);
+
+    if(fd == -1 || fstat(fd, &st) == -1)
+    {
+        perror(path);
+        exit(1);
+    }
+    char *s = malloc(st.st_size + 1);
+    *len = read(fd, s, st.st_size) == st.st_size ? (size_t)st.st_size : 0;
+    close(fd);
+    return s;
+}
+
+/* function that makes a temporary file named like 'name' holding 'times'
+    copies of s[0..len), and returns its path */
+char *benchFile(const char *name, const char *s, size_t len, int times)
+{
+    char *path = malloc(strlen(name) + 32);
+
+    sprintf(path, "/tmp/kilo-bench-XXXXXX-%s", name);
+    int fd = mkstemps(path, strlen(name) + 1);
+    if(fd == -1)
+        die("mkstemps");
+    while(times-- > 0)
+        if(write(fd, s, len) != (ssize_t)len)
+            die("write");
+    close(fd);
+    return path;
+}
+
+// text typed into the file by the typing workload
+const char *benchFunction =
+    "/* function that counts the rows holding a character */\n"
+    "int benchCountRows(int c)\n"
+    "{\n"
+    "    int rows = 0;\n"
+    "\n"
+    "    for(int y = 0; y < E.numrows; y++)\n"
+    "    {\n"
+    "        erow *row = editorRowAt(y);\n"
+    "        if(memchr(row->chars, c, row->size))\n"
+    "            rows++;\n"
+    "    }\n"
+    "    return rows; // \"rows\" with it\n"
+    "}\n";
+
+int main(int argc, char *argv[])
+{
+    struct benchScript sc = { NULL, 0, 0 };
+    size_t len;
+
+    printf("%-8s %6s %9s %9s %9s %9s %9s %9s %9s\n", "workload", "keys", "open ms",
+            "p50 us", "p99 us", "max us", "settle ms", "bytes/key", "allocs/key");
+
+    // a recorded script replayed on a file
+    if(argc >= 3)
+    {
+        char *script = benchSlurp(argv[2], &len);
+        int rows = argc >= 5 ? atoi(argv[3]) : 24, cols = argc >= 5 ? atoi(argv[4]) : 80;
+        benchSplit(&sc, script, len);
+        benchRun("replay", argv[1], &sc, rows, cols);
+        return 0;
+    }
+
+    char *src = benchSlurp(argc >= 2 ? argv[1] : "kilo.c", &len);
+    if(len == 0)
+    {
+        fprintf(stderr, "%s: nothing to build the workloads from\n", argc >= 2 ? argv[1] : "kilo.c");
+        return 1;
+    }
+
+    // a function typed a few screens down, partly taken back, then saved
+    char *typing = benchFile("typing.c", src, len, 1);
+    benchKeys(&sc, "\x1b[6~", 3);
+    for(int i = 0; i < 4; i++)
+        benchType(&sc, benchFunction);
+    benchKeys(&sc, "\x7f", 60);
+    benchKeys(&sc, "\x13", 1);
+    benchRun("typing", typing, &sc, 24, 80);
+    benchClear(&sc);
+
+    // a megabyte of source pasted into an empty file, and looked over
+    char *paste = benchFile("paste.c", "\n", 1, 1);
+    size_t pastelen = 0;
+    char *text = malloc((1 << 20) + len);
+    while(pastelen < (1 << 20))
+    {
+        memcpy(text + pastelen, src, len);
+        pastelen += len;
+    }
+    benchPaste(&sc, text, pastelen);
+    benchKeys(&sc, "\x1b[5~", 20);
+    benchKeys(&sc, "\x1b[A", 40);
+    benchType(&sc, "/* pasted */\n");
+    benchRun("paste", paste, &sc, 24, 80);
+    benchClear(&sc);
+
+    // paging through 64 MB, opened lazily
+    char *large = benchFile("large.c", src, len, (64 << 20) / len + 1);
+    benchKeys(&sc, "\x1b[6~", 2000);
+    benchKeys(&sc, "\x1b[B", 300);
+    benchKeys(&sc, "\x1b[5~", 500);
+    benchRun("scroll", large, &sc, 24, 80);
+    benchClear(&sc);
+
+    // a literal typed into the prompt and stepped through, then a regex and a miss
+    benchKeys(&sc, "\x06", 1);
+    benchType(&sc, "editorRowAt(");
+    benchKeys(&sc, "\x1b[B", 20);
+    benchKeys(&sc, "\r", 1);
+    benchKeys(&sc, "\x06", 1);
+    benchKeys(&sc, "\x12", 1);
+    benchType(&sc, "row->[a-z]+\\[");
+    benchKeys(&sc, "\x1b[B", 5);
+    benchKeys(&sc, "\r", 1);
+    benchKeys(&sc, "\x06", 1);
+    benchType(&sc, "zqzqzq");
+    benchKeys(&sc, "\x1b", 1);
+    benchRun("search", large, &sc, 24, 80);
+    benchClear(&sc);
+
+    // the source as one 16 MB line, edited at both ends
+    char *line = malloc(len);
+    for(size_t i = 0; i < len; i++)
+        line[i] = src[i] == '\n' ? ' ' : src[i];
+    char *giant = benchFile("giant.c", line, len, (16 << 20) / len + 1);
+    int fd = open(giant, O_WRONLY | O_APPEND);
+    if(fd == -1 || write(fd, "\n", 1) != 1)
+        die("write");
+    close(fd);
+    benchKeys(&sc, "\x1b[F", 1);
+    benchType(&sc, "int x = 1; /* at the end */");
+    benchKeys(&sc, "\x1b[H", 1);
+    benchType(&sc, "int y = 2; /* at the start */");
+    benchKeys(&sc, "\x7f", 20);
+    benchRun("giant", giant, &sc, 24, 80);
+    benchClear(&sc);
+
+    // lines of a few kilobytes, a comment opened and closed above all of them
+    for(size_t i = 0, lines = 0; i < len; i++)
+        line[i] = src[i] == '\n' && ++lines % 500 != 0 ? ' ' : src[i];
+    char *wide = benchFile("long.c", line, len, 4);
+    benchKeys(&sc, "\x1b[6~", 1);
+    benchKeys(&sc, "\x1b[H", 1);
+    benchType(&sc, "/* opened ");
+    benchKeys(&sc, "\x1b[6~", 2);
+    benchType(&sc, "and closed */");
+    benchKeys(&sc, "\x1b[6~", 20);
+    benchRun("long", wide, &sc, 24, 80);
+    benchClear(&sc);
+
+    unlink(typing);
+    unlink(paste);
+    unlink(large);
+    unlink(giant);
+    unlink(wide);
+    return 0;
+}
@@ -0,0 +1,227 @@
+/* Microbenchmark for the search engine. It counts the rows holding each query
+    with strstr (or strcasestr) on every rendered row, like kilo used to, then
+    with a search job on one thread and on one worker per processor, and
+    reports milliseconds per pass for each. Large files are first searched
+    straight out of the mapping, before any row is loaded, which is how a
+    search through a freshly opened file runs. Last it types each query a
+    character at a time, searching from scratch on every keystroke and then
+    narrowing what the shorter query found. Regex queries are timed against
+    the C library's regexec instead, and are not typed.
+
+    usage: bench/search <file> [passes] [query...]
+    a query starting with '~' ignores case, then one starting with '/' is a regex
+*/
+#define KILO_NO_MAIN
+#include "../kilo.c"
+#include <regex.h>
+
+
+/* benchmark */
+// function that returns a monotonic time in seconds
+double benchNow()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// function that sleeps until every chunk of the running search is done
+void benchWait()
+{
+    while(E.search->nthreads &&
+            __atomic_load_n(&E.search->finished, __ATOMIC_ACQUIRE) < E.search->nchunks)
+    {
+        struct pollfd pfd = { E.search->wake[0], POLLIN, 0 };
+        poll(&pfd, 1, -1);
+        editorSearchPoll();
+    }
+}
+
+// function that counts the rows holding a query with a search job
+int benchCount(const struct searchNeedle *nd, int regex, int threads)
+{
+    int rank, rows;
+
+    editorSearchStart(nd->s, nd->nocase, regex, threads);
+    benchWait();
+    rows = editorSearchCount(-1, &rank);
+    editorSearchStop();
+    return rows;
+}
+
+// function that searches every prefix of a query in turn, as typing it would
+int benchType(const struct searchNeedle *nd, int narrow)
+{
+    char *prefix = malloc(nd->len + 1);
+    int rank, rows = 0;
+
+    for(int len = 1; len <= nd->len; len++)
+    {
+        memcpy(prefix, nd->s, len);
+        prefix[len] = '\0';
+        if(!narrow)
+            editorSearchStop();
+        editorSearchStart(prefix, nd->nocase, 0, 0);
+        benchWait();
+        rows = editorSearchCount(-1, &rank);
+    }
+    editorSearchStop();
+    free(prefix);
+    return rows;
+}
+
+// function that counts the rows holding a query with the C library
+int benchCountLibc(const char *query, int nocase, int regex)
+{
+    regex_t re;
+    int rows = 0, cap = 0;
+    char *line = NULL;
+
+    if(regex && regcomp(&re, query, REG_EXTENDED | REG_NOSUB | (nocase ? REG_ICASE : 0)))
+        return -1;
+    for(erow *row = editorRowAt(0); row; row = editorRowNext(row))
+    {
+        // rows without tabs render as their characters, which are not terminated
+        int len;
+        editorRowFlat(row);
+        char *render = searchRowRender(row, &len);
+        if(len + 1 > cap)
+        {
+            cap = len + 1;
+            line = realloc(line, cap);
+        }
+        memcpy(line, render, len);
+        line[len] = '\0';
+        if(render != row->render && render != row->chars)
+            free(render);
+        if(regex ? !regexec(&re, line, 0, NULL, 0) :
+                (nocase ? strcasestr(line, query) : strstr(line, query)) != NULL)
+            rows++;
+    }
+    if(regex)
+        regfree(&re);
+    free(line);
+    return rows;
+}
+
+int main(int argc, char *argv[])
+{
+    char *defaults[] = { "zq", "~while", "kilo_no_such_identifier",
+            "~a query far too long to be anywhere in this file at all",
+            "/^ +if\\(.*\\) *$", "~/(editor|row)[a-z]+\\(", "/[0-9]+ *\\* *[0-9]+", NULL };
+
+    if(argc < 2)
+    {
+        fprintf(stderr, "usage: %s <file> [passes] [query...]\n", argv[0]);
+        return 1;
+    }
+    int passes = argc >= 3 ? atoi(argv[2]) : 20;
+    char **queries = argc >= 4 ? &argv[3] : defaults;
+    int nq, q, p, mismatches = 0;
+
+    for(nq = 0; queries[nq]; nq++)
+        ;
+
+    E.hl_gen = 1;
+    E.hlcp_damage = -1;
+    editorOpen(argv[1]);
+
+    struct searchNeedle *nd = malloc(sizeof(struct searchNeedle) * nq);
+    int *count = malloc(sizeof(int) * nq);
+    double *mapped = malloc(sizeof(double) * nq);
+    double *mappedpar = malloc(sizeof(double) * nq);
+    int *regex = malloc(sizeof(int) * nq);
+    for(q = 0; q < nq; q++)
+    {
+        int nocase = queries[q][0] == '~';
+        regex[q] = queries[q][nocase] == '/';
+        searchCompile(&nd[q], queries[q] + nocase + regex[q], nocase);
+        mapped[q] = -1;
+    }
+
+    // straight out of the mapping, no row gets loaded
+    if(E.map)
+        for(q = 0; q < nq; q++)
+        {
+            double t = benchNow();
+            for(p = 0; p < passes; p++)
+                count[q] = benchCount(&nd[q], regex[q], 1);
+            mapped[q] = (benchNow() - t) / passes;
+
+            t = benchNow();
+            for(p = 0; p < passes; p++)
+                if(benchCount(&nd[q], regex[q], 0) != count[q])
+                    mismatches++;
+            mappedpar[q] = (benchNow() - t) / passes;
+        }
+
+    long bytes = 0;
+    for(erow *row = editorRowAt(0); row; row = editorRowNext(row))
+        bytes += row->rsize;
+    printf("%d rows, %ld bytes, %d passes, %ld processors%s\n", E.numrows, bytes,
+            passes, sysconf(_SC_NPROCESSORS_ONLN), E.map ? ", mapped" : "");
+
+    for(q = 0; q < nq; q++)
+    {
+        double t = benchNow();
+        int libc = 0, rows = 0, rowspar = 0;
+        for(p = 0; p < passes; p++)
+            libc = benchCountLibc(nd[q].s, nd[q].nocase, regex[q]);
+        double legacy = (benchNow() - t) / passes;
+
+        t = benchNow();
+        for(p = 0; p < passes; p++)
+            rows = benchCount(&nd[q], regex[q], 1);
+        double current = (benchNow() - t) / passes;
+
+        t = benchNow();
+        for(p = 0; p < passes; p++)
+            rowspar = benchCount(&nd[q], regex[q], 0);
+        double parallel = (benchNow() - t) / passes;
+
+        double typed = 0, narrowed = 0;
+        if(!regex[q])
+        {
+            t = benchNow();
+            for(p = 0; p < passes; p++)
+                if(benchType(&nd[q], 0) != libc)
+                    mismatches++;
+            typed = (benchNow() - t) / passes;
+
+            t = benchNow();
+            for(p = 0; p < passes; p++)
+                if(benchType(&nd[q], 1) != libc)
+                    mismatches++;
+            narrowed = (benchNow() - t) / passes;
+        }
+
+        if(rows != libc || rowspar != libc || (E.map && count[q] != libc))
+            mismatches++;
+
+        printf("\n%s\"%s\"%s: %d rows\n", regex[q] ? "regex " : "", nd[q].s,
+                nd[q].nocase ? " (any case)" : "", libc);
+        printf("  %-12s %9.3f ms\n", regex[q] ? "regexec:" :
+                nd[q].nocase ? "strcasestr:" : "strstr:", legacy * 1e3);
+        printf("  %-12s %9.3f ms (%.1fx)\n", "1 thread:", current * 1e3,
+                legacy / current);
+        printf("  %-12s %9.3f ms (%.1fx)\n", "workers:", parallel * 1e3,
+                legacy / parallel);
+        if(mapped[q] >= 0)
+        {
+            printf("  %-12s %9.3f ms (%.1fx)\n", "unloaded:", mapped[q] * 1e3,
+                    legacy / mapped[q]);
+            printf("  %-12s %9.3f ms (%.1fx)\n", "+ workers:", mappedpar[q] * 1e3,
+                    legacy / mappedpar[q]);
+        }
+        if(!regex[q])
+        {
+            printf("  %-12s %9.3f ms\n", "typed:", typed * 1e3);
+            printf("  %-12s %9.3f ms (%.1fx)\n", "narrowed:", narrowed * 1e3,
+                    typed / narrowed);
+        }
+        searchFree(&nd[q]);
+    }
+    printf("\nmismatched counts: %d\n", mismatches);
+    return mismatches != 0;
+}
@@ -0,0 +1,255 @@
+/* Microbenchmark for the syntax highlighter. It highlights every row of a
+    file with the highlighter as it was before the character class table and
+    vectorized scans, then with the current one, and reports rows per second
+    for both along with the comment state scan used by the checkpoints.
+
+    usage: bench/syntax <file> [passes]
+*/
+#define KILO_NO_MAIN
+#include "../kilo.c"
+
+
+/* legacy highlighter */
+// function that returns true if the specific character is a 'separtor character'
+int legacy_is_separator(int c)
+{
+    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+}
+
+// function that highlights a row one character at a time, like kilo used to
+void legacyUpdateSyntax(erow *row, int in_comment)
+{
+    int i = 0, prev_sep = 1, in_string = 0;
+
+    if(row->hl == NULL)
+        row->hl = rowAlloc(row->rsize);
+    memset(row->hl, HL_NORMAL, row->rsize);
+
+    char **keywords = E.syntax->keywords;
+    char *scs = E.syntax->singleline_comment_start;
+    char *mcs = E.syntax->multiline_comment_start;
+    char *mce = E.syntax->multiline_comment_end;
+    int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
+
+    while(i < row->rsize)
+    {
+        char c = row->render[i];
+        unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
+
+        if(scs_len && !in_string && !in_comment)
+        {
+            if(!strncmp(&row->render[i], scs, scs_len))
+            {
+                memset(&row->hl[i], HL_COMMENT, row->rsize - i);
+                break;
+            }
+        }
+
+        if(mcs_len && mce_len && !in_string)
+        {
+            if(in_comment)
+            {
+                row->hl[i] = HL_MLCOMMENT;
+                if(!strncmp(&row->render[i], mce, mce_len))
+                {
+                    memset(&row->hl[i], HL_MLCOMMENT, mce_len);
+                    i += mce_len;
+                    in_comment = 0;
+                    prev_sep = 1;
+                    continue;
+                }
+                else
+                {
+                    i++;
+                    continue;
+                }
+            }
+            else if(!strncmp(&row->render[i], mcs, mcs_len))
+            {
+                memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
+                i += mcs_len;
+                in_comment = 1;
+                continue;
+            }
+        }
+
+        if(E.syntax->flags & HL_HIGHLIGHT_STRINGS)
+        {
+            if(in_string)
+            {
+                row->hl[i] = HL_STRING;
+                if(c == '\\' && i + 1 < row->rsize)
+                {
+                    row->hl[i + 1] = HL_STRING;
+                    i += 2;
+                    continue;
+                }
+
+                if(c == in_string)
+                    in_string = 0;
+                prev_sep = 1;
+                i++;
+                continue;
+            }
+            else
+            {
+                if(c == '"' || c == '\'')
+                {
+                    in_string = c;
+                    row->hl[i] = HL_STRING;
+                    i++;
+                    continue;
+                }
+            }
+        }
+
+        if(E.syntax->flags & HL_HIGHLIGHT_NUMBERS)
+        {
+            if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
+                    (c == '.' && prev_hl == HL_NUMBER))
+            {
+                row->hl[i] = HL_NUMBER;
+                prev_sep = 0;
+                i++;
+                continue;
+            }
+        }
+
+        if(prev_sep)
+        {
+            int j;
+            for(j = 0; keywords[j]; j++)
+            {
+                int klen = strlen(keywords[j]);
+                int kw2 = keywords[j][klen - 1] == '|';
+
+                if(kw2)
+                    klen--;
+
+                if(!strncmp(&row->render[i], keywords[j], klen) &&
+                        legacy_is_separator(row->render[i + klen]))
+                {
+                    memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
+                    i += klen;
+                    break;
+                }
+            }
+
+            if(keywords[j] != NULL)
+            {
+                prev_sep = 0;
+                continue;
+            }
+        }
+
+        prev_sep = legacy_is_separator(c);
+        i++;
+    }
+
+    row->hl_open_comment = in_comment;
+}
+
+
+/* benchmark */
+// function that returns a monotonic time in seconds
+double benchNow()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        fprintf(stderr, "usage: %s <file> [passes]\n", argv[0]);
+        return 1;
+    }
+    int passes = argc >= 3 ? atoi(argv[2]) : 20;
+
+    // set up just enough of the editor to load a buffer without a terminal
+    E.hl_gen = 1;
+    E.hlcp_damage = -1;
+    editorOpen(argv[1]);
+    if(E.syntax == NULL)
+    {
+        // highlight anything as C so every file exercises the highlighter
+        E.syntax = &HLDB[0];
+        E.syntax->kwtab = editorCompileKeywords(E.syntax->keywords);
+        editorCompileClasses(E.syntax);
+    }
+
+    erow **rows = malloc(sizeof(erow *) * (E.numrows + 1));
+    unsigned char **expect = malloc(sizeof(unsigned char *) * (E.numrows + 1));
+    int j, p, in, mismatches = 0;
+    long bytes = 0;
+    for(j = 0; j < E.numrows; j++)
+    {
+        rows[j] = editorRowAt(j);
+        bytes += rows[j]->rsize;
+        // a wide row is only ever highlighted a window at a time
+        if(rows[j]->wide)
+        {
+            fprintf(stderr, "%s: line %d is too long to highlight whole\n", argv[1], j + 1);
+            return 1;
+        }
+    }
+
+    // legacy highlighter
+    double t = benchNow();
+    for(p = 0; p < passes; p++)
+        for(j = 0, in = 0; j < E.numrows; j++)
+        {
+            legacyUpdateSyntax(rows[j], in);
+            in = rows[j]->hl_open_comment;
+        }
+    double legacy = benchNow() - t;
+
+    for(j = 0; j < E.numrows; j++)
+    {
+        expect[j] = malloc(rows[j]->rsize + 1);
+        memcpy(expect[j], rows[j]->hl, rows[j]->rsize);
+        expect[j][rows[j]->rsize] = rows[j]->hl_open_comment;
+    }
+
+    // current highlighter
+    t = benchNow();
+    for(p = 0; p < passes; p++)
+        for(j = 0, in = 0; j < E.numrows; j++)
+        {
+            editorUpdateSyntax(rows[j], in);
+            in = rows[j]->hl_open_comment;
+        }
+    double current = benchNow() - t;
+
+    // comment state only, as used to build checkpoints
+    t = benchNow();
+    for(p = 0; p < passes; p++)
+        for(j = 0, in = 0; j < E.numrows; j++)
+            in = editorSyntaxScan(rows[j]->chars, rows[j]->size, in);
+    double scan = benchNow() - t;
+
+    // both highlighters have to agree on every byte and every row state
+    for(j = 0, in = 0; j < E.numrows; j++)
+    {
+        if(memcmp(expect[j], rows[j]->hl, rows[j]->rsize) ||
+                expect[j][rows[j]->rsize] != rows[j]->hl_open_comment ||
+                editorSyntaxScan(rows[j]->chars, rows[j]->size, in) !=
+                rows[j]->hl_open_comment)
+            mismatches++;
+        in = rows[j]->hl_open_comment;
+    }
+
+    double total = (double)E.numrows * passes;
+    printf("%d rows, %ld bytes, %d passes\n", E.numrows, bytes, passes);
+    printf("legacy highlighter:  %12.0f rows/s\n", total / legacy);
+    printf("current highlighter: %12.0f rows/s (%.1fx)\n", total / current,
+            legacy / current);
+    printf("comment state scan:  %12.0f rows/s\n", total / scan);
+    printf("mismatched rows: %d\n", mismatches);
+    return mismatches != 0;
+}
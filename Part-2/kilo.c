@@ -6,24 +6,85 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/inotify.h>
 #include <sys/ioctl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <termios.h>
 #include <time.h>
 #include <unistd.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 
 /* defines */
 #define KILO_VERSION "0.0.1"
 #define KILO_TAB_STOP 8
+#define KILO_RX_STEP 128 // characters between saved render offsets of a row with tabs
+#define KILO_WIDE_ROW (1 << 16) // rows this long are edited in a gap and drawn a window at a time
+#define KILO_WIDE_SPAN 4096 // characters between saved highlighter states of a wide row
+#define KILO_WIDE_MARGIN 16 // characters read past a window so tokens at its edge come out right
 #define KILO_QUIT_TIMES 3
+#define KILO_MMAP_THRESHOLD (1 << 20) // files this large are opened lazily
+#define KILO_LOAD_SLICE (1 << 22) // fewest bytes of a mapped file worth a loader thread
+#define KILO_LOAD_THREADS 8 // most threads that index the lines of a mapped file
+#define KILO_LOAD_BLOCK (1 << 16) // bytes read at once from a file that is not mapped
+#define KILO_LINE_MAX (1 << 30) // longest line a row can hold, its size is an int that grows by half
+#define KILO_HL_CHECKPOINT 256 // rows between saved comment states
+#define KILO_HL_LOOKAHEAD 8 // rows highlighted past the bottom of the screen
+#define KILO_HL_IDLE_ROWS 4096 // rows rescanned per step while waiting for keys
+#define KILO_HL_ASYNC 4096 // rows this long are highlighted by the workers
+#define KILO_HL_THREADS 4 // most highlighting workers
+#define KILO_DIFF_GAP 8 // unchanged cells worth rewriting to avoid a cursor move
+#define KILO_SEARCH_LONG 32 // needles this long are searched with Horspool
+#define KILO_SEARCH_WINDOW (1 << 16) // bytes scanned per step of a backward search
+#define KILO_SEARCH_CHUNK (1 << 20) // bytes of the buffer a search worker takes at once
+#define KILO_SEARCH_THREADS 8 // most workers a search runs on
+#define KILO_REGEX_STATES 2048 // DFA states cached before the cache is flushed
+#define KILO_SAVE_IOV 1024 // pieces of the buffer handed to one writev
+#define KILO_SAVE_SYNC 1 // flush a save to disk before it replaces the file
+#define KILO_INPUT_BUF 4096 // bytes read from the terminal at once
+#define KILO_ESC_TIMEOUT 100 // ms an escape sequence may take to arrive
+#define KILO_PASTE_TIMEOUT 1000 // ms of silence that ends an unterminated paste
+#define KILO_STATUS_SECS 5 // seconds a status message stays up
+#define KILO_SLAB_MIN 16 // smallest row storage block
+#define KILO_SLAB_CLASSES 9 // power of two block sizes carved from slabs, up to 4 KB
+#define KILO_SLAB_MAX (KILO_SLAB_MIN << (KILO_SLAB_CLASSES - 1))
+#define KILO_SLAB_CHUNK (1 << 16) // bytes of a slab
+#define KILO_ARENA_BLOCK (1 << 20) // bytes of a block of the arena rows are read into
+#define KILO_WATCH_VERIFY 4096 // bytes before the old end of a file checked before loading an append
+#ifndef KILO_AUTOSAVE
+#define KILO_AUTOSAVE 0 // seconds a modified buffer waits to be saved, 0 never saves
+#endif
 #define CTRL_KEY(k) ((k) & 0x1f)
+#define ASCII_LOWER(c) ((c) >= 'A' && (c) <= 'Z' ? (c) + 32 : (c))
+#define ASCII_UPPER(c) ((c) >= 'a' && (c) <= 'z' ? (c) - 32 : (c))
 #define HL_HIGHLIGHT_NUMBERS (1<<0)
 #define HL_HIGHLIGHT_STRINGS (1<<1)
+#define HLC_SEP (1<<0) // character classes used by the highlighter
+#define HLC_DIGIT (1<<1)
+#define HLC_QUOTE (1<<2)
+#define HLC_DELIM (1<<3) // first character of a comment delimiter
+#define HLC_STOP (HLC_SEP | HLC_DIGIT | HLC_QUOTE | HLC_DELIM)
+#define ATTR_DEFAULT 39 // screen cell attribute: SGR color, plus reverse video
+#define ATTR_REVERSE 0x80
+#define RX_BOL 256 // regex events past the bytes: the start and end of a line
+#define RX_EOL 257
+#define RX_SYMBOLS 258
 
 enum editorKey
 {
@@ -36,7 +97,10 @@ enum editorKey
     HOME_KEY,
     END_KEY,
     PAGE_UP,
-    PAGE_DOWN
+    PAGE_DOWN,
+    SEARCH_UPDATE, // not a key: a background search has more results
+    SCREEN_UPDATE, // not a key: a save moved on, the window resized or a timer fired
+    PASTE_KEY // a bracketed paste, its text is in E.paste
 };
 
 enum editorHighlight // highlight types
@@ -51,8 +115,37 @@ enum editorHighlight // highlight types
     HL_MATCH
 };
 
+enum regexOp
+{
+    RX_SET = 0, // program: consume one symbol of a set
+    RX_SPLIT, // program: go on at both 'out' and 'out1'
+    RX_ASSERT, // program: go on at 'out' on event 'out1', RX_BOL or RX_EOL
+    RX_MATCH, // program: a match ends here
+    RXN_SET, // parse tree: one symbol of a set
+    RXN_ASSERT, // parse tree: '^' or '$', event 'a'
+    RXN_CAT, // parse tree: 'a' then 'b'
+    RXN_ALT, // parse tree: 'a' or 'b'
+    RXN_STAR,
+    RXN_PLUS,
+    RXN_QUEST,
+    RXN_EMPTY
+};
+
 
 /* data */
+struct editorKeyword // one slot of a compiled keyword table
+{
+    const char *word; // NULL for an empty slot
+    int len, type; // length without the '|' suffix and highlight type
+};
+
+struct editorKeywords // perfect hash table built from a keyword list
+{
+    struct editorKeyword *slot;
+    unsigned int mask, seed; // table size - 1 and the seed with no collisions
+    int minlen, maxlen; // shortest and longest keyword
+};
+
 struct editorSyntax
 {
     char *filetype;
@@ -60,16 +153,309 @@ struct editorSyntax
     char *singleline_comment_start;
     char *multiline_comment_start, *multiline_comment_end;
     int flags;
+    struct editorKeywords *kwtab; // keywords compiled when first selected
+    unsigned char *cclass; // HLC_* class of every byte, built with kwtab
+    int cclass_simd; // letters, '_' and bytes >= 0x80 are never HLC_STOP
 };
 
 typedef struct erow // struct for individual line
 {
-    int idx, size, rsize; // index, row size and rendered row size
-    char *chars, *render; // row characters
+    int size, rsize; // row size and rendered row size
+    char *chars; // row characters
+    char *render; // row as it shows, chars itself unless the row has tabs
     unsigned char *hl; // for highlighting different types of characters
+    int tabbed; // render is a copy that follows hl in the same block
+    int *rxmark; // render offset of every KILO_RX_STEP'th character, for rows with tabs
+    int nrxmark, caprxmark; // marks still valid from the start of the row, and room for them
+    struct rowWide *wide; // set while the row is longer than KILO_WIDE_ROW
     int hl_open_comment; // highlight open comment in row
+    int hl_in; // comment state hl was computed for, -1 if hl is stale
+    unsigned int hl_gen; // syntax generation hl was computed for
+    int hl_defer; // an edit's effect on the rows below waits for the workers
+    int borrowed; // chars belong to the mapping or the load arena, not the row
+    int cap; // bytes allocated for chars when the row owns them
+    unsigned int save_gen; // save whose snapshot still reads chars
+    unsigned int version; // bumped on every edit, so highlighting of older characters is told apart
 } erow;
 
+struct hlState // where the highlighter stands inside a line
+{
+    int in_comment; // inside a multiline comment
+    int in_string; // quote of the string it is inside, or 0
+    int prev_sep; // the character before ends a token
+    int prev_hl; // highlight of the character before
+    int rest; // a single line comment runs to the end of the line
+};
+
+struct hlJob // a row handed to the highlighting workers
+{
+    struct hlJob *next; // in the queue or among the finished jobs
+    erow *row; // row the job is for, NULL once it is gone
+    unsigned int version, gen; // edit version of the row and syntax generation
+    struct editorSyntax *syntax;
+    int in, out; // comment state the row starts in and the one it ends in
+    char *text; // copy of the render, the row may change under the worker
+    unsigned char *hl; // highlighting of the text, written by the worker
+    int len; // bytes of text, -1 once the job is dropped
+    unsigned int frame; // last frame that drew the row
+};
+
+/* Workers highlight long rows while the editor goes on, a row is drawn
+    plain until its highlighting comes back. The main thread owns 'job' and
+    the rows; the queue and the finished jobs are shared under 'lock'. */
+struct hlPool
+{
+    pthread_t thread[KILO_HL_THREADS];
+    int nthreads;
+    pthread_mutex_t lock;
+    pthread_cond_t cond; // signalled when the queue gets a job
+    struct hlJob *todo, *todo_tail; // jobs no worker took yet
+    struct hlJob *done; // jobs finished and not yet picked up
+    struct hlJob **job; // every job handed out and not picked up
+    int njobs, capjobs;
+    int wake[2]; // written by a worker whenever it finishes a job
+    unsigned int frame; // bumped for every frame drawn
+    erow **defer; // rows with hl_defer set
+    int ndefer, capdefer;
+};
+
+struct hlMark // highlighter state saved inside a wide row
+{
+    int pos; // character the state is at
+    struct hlState st;
+};
+
+/* A row longer than KILO_WIDE_ROW keeps a gap in chars where the last edit
+    was, so typing does not move the rest of the line, and it has no render
+    or hl: the part on screen is rendered and highlighted when it is drawn,
+    from the nearest saved highlighter state. Whatever needs the whole line
+    at once closes the gap first. */
+struct rowWide
+{
+    int gap; // the gap sits before this character, chars[gap..gap + cap - size - 1)
+    int ntabs; // tabs in the row, -1 if they need counting
+    int quiet; // the last edit cannot have changed the comment state the row ends in
+    struct hlMark *mark; // states in order of position, built as far as something was drawn
+    int nmark, capmark;
+    int mark_in; // comment state the row started in when the marks were made
+    unsigned int mark_gen;
+    int match_rx, match_len; // search match drawn over the window
+};
+
+/* rows are kept in an implicit treap ordered by position, so inserting or
+   deleting a line is O(log n) and a row's index is derived from its rank */
+struct rownode
+{
+    erow row; // must stay first so an erow * can be cast back to its node
+    struct rownode *left, *right, *parent;
+    unsigned int prio; // heap priority that keeps the tree balanced
+    int count; // number of rows in this subtree
+    int first, span; // file lines a not yet loaded node stands for
+};
+
+struct abuf // append buffer
+{
+    char *b;
+    int len, cap; // bytes used and allocated
+};
+
+struct screenFrame // what every cell of the screen shows
+{
+    int rows, cols;
+    char *glyph; // character of every cell, row by row
+    unsigned char *attr; // ATTR_* color and reverse video of every cell
+    int valid; // false until the frame has been filled in once
+};
+
+struct searchNeedle
+{
+    char *s; // the query, folded to lower case when 'nocase' is set
+    int len;
+    int nocase; // ASCII letters match either case
+    int has_space; // tabs render as spaces, so lines with tabs need a second look
+    int shift[256]; // Horspool shift for each last byte, long needles only
+};
+
+struct regexNode // parse tree of a regex
+{
+    int op; // RXN_*
+    int a, b; // operands
+    unsigned char set[RX_SYMBOLS / 8 + 1]; // symbols of a RXN_SET
+};
+
+struct regexState // one instruction of a compiled regex
+{
+    int op; // RX_SET, RX_SPLIT, RX_ASSERT or RX_MATCH
+    int out, out1;
+    unsigned char set[RX_SYMBOLS / 8 + 1];
+};
+
+struct regex
+{
+    struct regexState *nfa;
+    int nnfa;
+    int fwd, rev; // entry of the program, and of the program matching backwards
+    unsigned char cls[RX_SYMBOLS]; // bytes no instruction tells apart share a class
+    int nclasses;
+    struct searchNeedle lit; // longest literal every match holds
+    int haslit;
+};
+
+struct regexDfa // lazily built DFA for one program, owned by one thread
+{
+    const struct regex *re;
+    int entry; // NFA state the DFA starts from
+    int unanchored; // the entry joins every state, so a match may start anywhere
+    int n; // states built so far
+    int *next; // n * nclasses transitions, -1 until taken once
+    int *setoff; // where the NFA states of every DFA state start in 'pool'
+    int *pool, npool, cappool;
+    unsigned char *accept;
+    int *table; // open hash of NFA state sets, 2 * KILO_REGEX_STATES slots
+    int init; // state before any symbol, -1 until built
+    int flushes; // times the cache was thrown away
+    int *mark, gen; // NFA states visited by the current closure
+    int *stack, *work;
+};
+
+struct regexCache // DFAs one thread runs a regex with
+{
+    struct regexDfa fwd, rev;
+};
+
+struct searchHit
+{
+    int row; // row holding a match
+    int rx; // render offset of its first match
+    int len; // length of that match
+};
+
+struct searchChunk
+{
+    int row, lines; // rows the chunk covers
+    int first; // line of the mapping, or entry of 'rows', the chunk starts at
+    int mapped; // lines are read from the mapping and may hold tabs
+    struct searchHit *hit; // matching rows, in order
+    int nhits;
+    int done; // set once 'hit' is final, read atomically
+    int narrow; // only rows in 'cand' can match
+    struct searchHit *cand; // what a shorter query found in the chunk
+    int ncand;
+};
+
+struct searchJob
+{
+    struct searchNeedle nd;
+    struct searchChunk *chunk; // the whole buffer, in row order
+    int nchunks;
+    erow **rows; // loaded rows, the tree may change shape under the workers
+    pthread_t *thread;
+    int nthreads;
+    int next; // next chunk for a worker to take
+    int finished; // chunks done so far
+    int seen; // value of 'finished' the screen last showed
+    int cancel; // tells the workers to stop
+    int wake[2]; // written by a worker whenever it finishes a chunk
+    int current; // row of the selected match, or -1
+    int pending; // a step is waiting for chunks that are not done yet
+    int shift; // where the query the candidates came from sits in this one
+    struct regex *re; // the query as a regex, in regex mode
+    int bad; // the query is not a valid regex
+};
+
+struct loadSlice // part of a mapped file a loader thread splits into lines
+{
+    const char *map;
+    size_t from, to; // offsets of the slice in the mapping
+    size_t lines; // newlines found in it
+    size_t *off; // where the starts of its lines go, NULL when they are only counted
+};
+
+struct rowBlock // header of a block too large for the slabs
+{
+    struct rowBlock *prev, *next;
+};
+
+struct rowStore // where rows, their characters, render and hl are allocated
+{
+    void *free[KILO_SLAB_CLASSES]; // free blocks of every size class, linked through themselves
+    char **chunk; // slabs and arena blocks, freed together
+    int nchunks, capchunks;
+    char *arena; // unused part of the current arena block
+    size_t arena_left;
+    struct rowBlock large; // list of blocks too large for the slabs
+    long long mallocs; // calls into malloc made for rows
+    long long blocks; // blocks handed out and not given back
+    size_t slab_bytes, arena_bytes, large_bytes; // bytes taken from malloc for each
+};
+
+struct saveJob // snapshot of the buffer being written by a background thread
+{
+    struct iovec *iov; // the buffer as pieces of rows and of the mapping
+    int n, cap;
+    long long size; // bytes in the snapshot
+    long long written; // bytes on disk so far, written by the writer thread
+    int fd;
+    char *path, *tmpname; // file to replace and the file written in its place
+    unsigned int gen; // save_gen of the rows the snapshot reads
+    int dirty; // E.dirty when the snapshot was taken
+    struct iovec *dead; // row buffers and their capacities edits let go of
+    int ndead, capdead; // while the writer still reads them
+    int done, err; // set by the writer when it stops, err is 0 or an errno
+    int ticks, seen; // progress steps written and shown
+    int wake[2]; // pipe the writer pokes the UI through
+    int again; // Ctrl-S was pressed during the save
+    pthread_t thread;
+    struct timespec t0;
+};
+
+/* A replay stands in for the terminal: the window has a fixed size, frames
+    are only counted, and keys come from a script one at a time. The editor
+    asks for the next one once it has nothing left to do, so every key is
+    handled on a settled editor. */
+struct editorReplay
+{
+    int rows, cols; // size of the virtual terminal
+    // called with 0 when the editor first waits for a key, with 1 to go on to the next key
+    void (*key)(int next);
+    int (*read)(unsigned char *buf, int len); // copies out up to 'len' bytes of the key
+    long frames, bytes; // frames drawn and the output they took
+};
+
+/* Counters bumped on the hot paths, cheap enough to always keep. Ctrl-G
+    shows them in the status bar and KILO_STATS names a file they are written
+    to on exit. */
+struct editorStats
+{
+    long keys; // keys read
+    long reads; // reads that filled the input buffer
+    long highlights; // rows highlighted whole
+    long appends, appended; // calls to abAppend and the bytes they added
+    long frames, written; // frames drawn and the bytes they took
+    double frame_secs, frame_max, frame_total; // time building the last frame, the slowest and all
+    int frame_bytes; // bytes of the last frame
+    long key_reads; // reads it took to get the last key, 0 if it came with the one before
+    long mark_reads, mark_highlights; // counts when the last key was read
+    long rss; // resident size when the last key was read, sampled while the counters are shown
+};
+
+/* A line of the file as it is on disk or of the buffer, hashed, when the two
+    are compared after the file changed */
+struct reloadLine
+{
+    const char *s;
+    int len;
+    unsigned int hash;
+};
+
+/* A slot of the table the lines between the first and last change are
+    counted in, by the first buffer row holding the line */
+struct reloadSlot
+{
+    int old; // index of the row, -1 for an empty slot
+    int nold, nnew; // times the line is in the buffer and in the file
+};
+
 struct editorConfig
 {
     int cx, cy, rx; // x, y position of cursor
@@ -77,12 +463,53 @@ struct editorConfig
     int screenrows, screencols; // # of rows and columns shown on screen
     int numrows; // number of rows
     int dirty; // variable to keep track of modified buffer
-    erow *row; 
+    struct rownode *rows; // root of the row tree
     char *filename; // filename of current file
+    const char *map; // contents of a lazily opened file
+    size_t maplen; // length of the mapping
+    size_t *lineoff; // offset of every line in the mapping
+    int mapfd; // the mapped file, open for the read lease on it, -1 without one
+    size_t mappage; // page size, set once editorMapFault is catching SIGBUS
     char statusmsg[80]; // array to hold status msg for user
     time_t statusmsg_time;
     struct editorSyntax *syntax;
+    unsigned int hl_gen; // bumped whenever the syntax changes
+    unsigned char *hlcp; // comment state entering every KILO_HL_CHECKPOINT rows
+    int hlcp_len, hlcp_cap; // number of valid and allocated checkpoints
+    int hlcp_stale; // checkpoints up to here predate edits but still line up
+    int hlcp_damage; // last row edited since the stale checkpoints were valid
+    int hlcp_want; // how far checkpoints reached before edits cut them back
     struct termios orig_termios; // restore terminal at exit
+    struct screenFrame frame; // frame being drawn
+    struct screenFrame shadow; // frame the terminal is showing
+    int shadow_rowoff; // rowoff the shadow frame was drawn with
+    struct abuf out; // output of a refresh, keeps its capacity between frames
+    int search_nocase; // searches ignore case
+    int search_regex; // queries are regexes
+    struct searchJob *search; // search running behind the prompt
+    struct saveJob *save; // save being written in the background
+    unsigned int save_gen; // bumped for every save snapshot
+    unsigned char inbuf[KILO_INPUT_BUF]; // bytes read from the terminal
+    int inpos, inlen; // next byte to decode and end of what was read
+    struct abuf paste; // text of the last bracketed paste
+    int sigfd; // signalfd the resize signal arrives on, -1 without an event loop
+    int timerfd; // timerfd for status message expiry and autosave
+    time_t timer_at; // when the timer is armed for, 0 if it is not
+    time_t autosave_at; // when a modified buffer gets saved, 0 if it does not
+    struct rowStore store; // memory of the rows
+    struct editorReplay *replay; // plays keys into a headless editor, NULL on a terminal
+    int recordfd; // file the keys read are copied to, -1 if they are not recorded
+    struct editorStats stats; // performance counters
+    int stats_shown; // the status bar shows the counters
+    int statsfd; // file the counters are written to on exit, -1 if they are not
+    struct hlPool *hlpool; // highlighting workers, NULL until a long row needs them
+    unsigned int row_version; // last edit version given to a row
+    int watchfd; // inotify descriptor the file is watched through, -1 without an event loop
+    int watchwd; // watch on the directory holding the file, -1 if it is not watched
+    char *watchname; // name of the file in that directory
+    struct stat disk; // the file as the buffer last matched it
+    int disk_nl; // the file ends in a newline
+    int watch_pending; // the file changed while it could not be reloaded
 };
 
 struct editorConfig E;
@@ -107,7 +534,8 @@ struct editorSyntax HLDB[] = {
         C_HL_extensions, // uses file extention types
         C_HL_keywords, // uses keywords 
         "//", "/*", "*/", // uses comment delimiters
-        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS
+        HL_HIGHLIGHT_NUMBERS | HL_HIGHLIGHT_STRINGS,
+        NULL, NULL, 0 // keyword and class tables, compiled on first use
     },
 };
 
@@ -118,7 +546,89 @@ struct editorSyntax HLDB[] = {
 // function declarations
 void editorSetStatusMessage(const char *fmt, ...);
 void editorRefreshScreen();
+void editorRenderRow(erow *row);
+int editorSyntaxIdle();
 char *editorPrompt(char *prompt, void (*callback)(char *, int));
+int editorSearchPoll();
+int editorHighlightPoll();
+int editorSavePoll();
+int editorSaveStart(const char *filename);
+void editorScroll();
+int getWindowSize(int *rows, int *cols);
+void saveKeep(char *chars, int cap);
+int editorRowScan(erow *row, int in_comment);
+void editorRowFlat(erow *row);
+void editorHighlightForget(erow *row);
+void editorSyntaxSettle(erow *row, int told);
+void editorSearchStop();
+void editorSaveFinish();
+void editorMapPrivate();
+void editorWatchFile();
+void editorWatchPoll();
+int editorReloadCheck();
+void abAppend(struct abuf *ab, const char *s, int len);
+
+
+/* counters */
+// function that returns a monotonic time in seconds
+double editorNow()
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// function that returns the resident size of the editor in bytes, 0 if it is unknown
+long editorRss()
+{
+    long pages, rss = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+
+    if(fp)
+    {
+        if(fscanf(fp, "%ld %ld", &pages, &rss) != 2)
+            rss = 0;
+        fclose(fp);
+    }
+    return rss * sysconf(_SC_PAGESIZE);
+}
+
+// function that counts a key, so work can be told apart per key
+void editorStatsKey()
+{
+    struct editorStats *st = &E.stats;
+
+    st->keys++;
+    st->key_reads = st->reads - st->mark_reads;
+    st->mark_reads = st->reads;
+    st->mark_highlights = st->highlights;
+    // reading /proc is left out of the frames the counters time
+    if(E.stats_shown)
+        st->rss = editorRss();
+}
+
+// function that writes the counters to the KILO_STATS file, run at exit
+void editorStatsDump()
+{
+    struct editorStats *st = &E.stats;
+    long keys = st->keys ? st->keys : 1, frames = st->frames ? st->frames : 1;
+
+    if(E.statsfd == -1)
+        return;
+    dprintf(E.statsfd, "keys %ld\n" "reads %ld\n" "reads_per_key %.2f\n"
+            "highlights %ld\n" "highlights_per_key %.2f\n"
+            "appends %ld\n" "appended_bytes %ld\n"
+            "frames %ld\n" "written_bytes %ld\n" "bytes_per_frame %.1f\n"
+            "frame_ms_mean %.3f\n" "frame_ms_max %.3f\n" "rss_bytes %ld\n",
+            st->keys, st->reads, (double)st->reads / keys,
+            st->highlights, (double)st->highlights / keys,
+            st->appends, st->appended,
+            st->frames, st->written, (double)st->written / frames,
+            st->frame_total * 1e3 / frames, st->frame_max * 1e3, editorRss());
+    close(E.statsfd);
+    E.statsfd = -1;
+}
 
 
 /* terminal */
@@ -135,6 +645,7 @@ void die(const char *s)
 // disable raw mode
 void disableRawMode()
 {
+    write(STDOUT_FILENO, "\x1b[?2004l", 8);
     if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &E.orig_termios) == -1)
         die("tcsetattr");
 }
@@ -156,109 +667,380 @@ void enableRawMode()
     raw.c_cflag |= (CS8);
     // disable echo, canonical, extention, signal character flags
     raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
-    raw.c_cc[VMIN] = 0; // set minimum # of bytes
-    raw.c_cc[VTIME] = 1; // set max amount of time to wait before read() returns
+    // reads only happen once poll says there is input, so they need not time out
+    raw.c_cc[VMIN] = 1; // set minimum # of bytes
+    raw.c_cc[VTIME] = 0; // set max amount of time to wait before read() returns
 
     //enable raw mode
     if(tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw) == -1)
         die("tcsetattr");
+    // have the terminal mark pastes with CSI 200~ and CSI 201~
+    write(STDOUT_FILENO, "\x1b[?2004h", 8);
 }
 
-// function that reads in keys
-int editorReadKey()
+// function that returns true if a key is waiting to be read
+int editorInputPending()
+{
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+
+    if(E.replay)
+        return E.inpos < E.inlen;
+    return E.inpos < E.inlen || poll(&pfd, 1, 0) > 0;
+}
+
+/* function that reads whatever the terminal has into the input buffer in one
+    call, waiting up to 'timeout' ms for it (-1 waits for good), returns the
+    number of bytes read */
+int editorInputFill(int timeout)
 {
-    // variable declarations
+    struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
     int nread;
-    char c;
 
-    while((nread = read(STDIN_FILENO, &c, 1)) != 1)
+    if(E.inpos == E.inlen)
+        E.inpos = E.inlen = 0;
+    if(E.inlen == KILO_INPUT_BUF)
+    {
+        memmove(E.inbuf, E.inbuf + E.inpos, E.inlen - E.inpos);
+        E.inlen -= E.inpos;
+        E.inpos = 0;
+    }
+    // a replay has nothing more than the rest of the key it is on
+    if(E.replay)
     {
-        if((nread == -1 && errno != EAGAIN))
+        nread = E.replay->read(E.inbuf + E.inlen, KILO_INPUT_BUF - E.inlen);
+        E.stats.reads++;
+        E.inlen += nread;
+        return nread;
+    }
+    while(1)
+    {
+        int ready = poll(&pfd, 1, timeout);
+        if(ready == -1 && errno != EINTR)
+            die("poll");
+        if(ready <= 0)
+        {
+            if(ready == 0 && timeout >= 0)
+                return 0;
+            continue;
+        }
+        nread = read(STDIN_FILENO, E.inbuf + E.inlen, KILO_INPUT_BUF - E.inlen);
+        E.stats.reads++;
+        if(nread == -1 && errno != EAGAIN && errno != EINTR)
+            die("read");
+        // the terminal said there was input, so nothing means it hung up
+        if(nread == 0)
+        {
+            errno = EIO;
             die("read");
+        }
+        if(nread > 0)
+        {
+            if(E.recordfd != -1)
+                write(E.recordfd, E.inbuf + E.inlen, nread);
+            E.inlen += nread;
+            return nread;
+        }
+    }
+}
+
+// function that returns the next byte of input, or -1 if none came within 'timeout' ms
+int editorInputByte(int timeout)
+{
+    if(E.inpos == E.inlen && editorInputFill(timeout) == 0)
+        return -1;
+    return E.inbuf[E.inpos++];
+}
+
+/* function that collects the text of a bracketed paste up to the closing
+    CSI 201~, straight out of the input buffer, a block at a time */
+void editorReadPaste()
+{
+    static const char end[] = "\x1b[201~";
+    int endlen = sizeof(end) - 1;
+
+    E.paste.len = 0;
+    while(E.inpos < E.inlen || editorInputFill(KILO_PASTE_TIMEOUT) > 0)
+    {
+        int from = E.paste.len > endlen ? E.paste.len - endlen : 0;
+        abAppend(&E.paste, (char *)E.inbuf + E.inpos, E.inlen - E.inpos);
+        E.inpos = E.inlen;
+
+        // the closing sequence may have been split between two reads
+        char *p = memmem(E.paste.b + from, E.paste.len - from, end, endlen);
+        if(p)
+        {
+            // bytes after it are keys typed after the paste
+            int after = E.paste.len - (p - E.paste.b) - endlen;
+            E.inpos = E.inlen - after;
+            E.paste.len = p - E.paste.b;
+            return;
+        }
+    }
+}
+
+/* event loop */
+// function that sets up the descriptors the event loop waits on besides the terminal
+void editorInitEvents()
+{
+    sigset_t mask;
+
+    // the resize signal is read from a descriptor instead of interrupting
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGWINCH);
+    // and so is the lease on a mapped file being broken
+    sigaddset(&mask, SIGIO);
+    if(sigprocmask(SIG_BLOCK, &mask, NULL) == -1 ||
+            (E.sigfd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC)) == -1)
+        die("signalfd");
+    if((E.timerfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC)) == -1)
+        die("timerfd_create");
+    // without inotify the file is simply not watched
+    E.watchfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+}
+
+/* function that arms the timer for the next status message expiry or
+    autosave, and disarms it when neither is due, so an idle editor sleeps */
+void editorArmTimer()
+{
+    time_t now = time(NULL), at = 0;
+
+    if(E.timerfd == -1)
+        return;
+    if(E.statusmsg[0] && E.statusmsg_time + KILO_STATUS_SECS > now)
+        at = E.statusmsg_time + KILO_STATUS_SECS;
+
+    // the autosave clock starts with the first edit after a save
+    if(KILO_AUTOSAVE && E.dirty && E.filename && !E.save)
+    {
+        if(!E.autosave_at)
+            E.autosave_at = now + KILO_AUTOSAVE;
+        if(!at || E.autosave_at < at)
+            at = E.autosave_at;
+    }
+    else
+    {
+        E.autosave_at = 0;
+    }
+
+    if(at == E.timer_at)
+        return;
+    struct itimerspec its = { { 0, 0 }, { at, 0 } };
+    timerfd_settime(E.timerfd, TFD_TIMER_ABSTIME, &its, NULL);
+    E.timer_at = at;
+}
+
+// function that handles the timer going off, the status message needs a redraw either way
+void editorTimerFired()
+{
+    uint64_t expirations;
+
+    read(E.timerfd, &expirations, sizeof(expirations));
+    E.timer_at = 0;
+    if(E.autosave_at && time(NULL) >= E.autosave_at)
+    {
+        E.autosave_at = 0;
+        if(editorSaveStart(E.filename) == -1)
+            editorSetStatusMessage("Cannot autosave! I/O error: %s", strerror(errno));
     }
+}
+
+// function that picks up a new window size after SIGWINCH
+void editorResize()
+{
+    if(getWindowSize(&E.screenrows, &E.screencols) == -1)
+        die("getWindowSize");
+    E.screenrows -= 2;
+    if(E.screenrows < 1)
+        E.screenrows = 1;
+    // whatever the terminal kept of the old screen cannot be trusted
+    E.shadow.valid = 0;
+    editorScroll();
+}
+
+// function that returns 1 while a search or save the screen is waiting on still runs
+int editorBackgroundBusy()
+{
+    return (E.search && E.search->nthreads && E.search->seen < E.search->nchunks) ||
+            E.save != NULL || (E.hlpool && E.hlpool->njobs);
+}
+
+/* function that sleeps until the terminal has input, returning 0, or until
+    something else needs the screen, returning the pseudo key for it. Rows
+    are highlighted in the background until there is no work left, after
+    that nothing wakes the editor up that does not need it */
+int editorWaitEvent()
+{
+    int busy = 1;
 
-    // check to see if the character 'c' is an escape character
-    if(c == '\x1b')
+    if(E.replay)
+        E.replay->key(0);
+    while(1)
     {
-        // small character array declaration
-        char seq[3];
-        // check for the conditions and return the escape character
-        if(read(STDIN_FILENO, &seq[0], 1) != 1)
-            return '\x1b';
-        if(read(STDIN_FILENO, &seq[1], 1) != 1)
-            return '\x1b';
+        // a change to the file waits for a save or search running over the rows
+        if(E.watch_pending && !E.save && !E.search && editorReloadCheck())
+            return SCREEN_UPDATE;
+        editorArmTimer();
+        // a replay does not wait for keys, only for the work it lets finish first
+        int idle = busy || (E.replay && !editorBackgroundBusy());
+        struct pollfd pfd[7] = { { E.replay ? -1 : STDIN_FILENO, POLLIN, 0 },
+                { E.sigfd, POLLIN, 0 },
+                { E.timerfd, POLLIN, 0 },
+                { E.search && E.search->nthreads ? E.search->wake[0] : -1, POLLIN, 0 },
+                { E.save ? E.save->wake[0] : -1, POLLIN, 0 },
+                { E.hlpool && E.hlpool->njobs ? E.hlpool->wake[0] : -1, POLLIN, 0 },
+                { E.watchwd != -1 ? E.watchfd : -1, POLLIN, 0 } };
+        int ready = poll(pfd, 7, idle ? 0 : -1);
+        if(ready == -1 && errno != EINTR)
+            die("poll");
+        if(ready == 0 && busy)
+            busy = editorSyntaxIdle();
+        else if(ready == 0 && E.replay)
+        {
+            // with nothing else left to do the next key comes in
+            E.replay->key(1);
+            editorInputFill(0);
+            return 0;
+        }
+        if(ready <= 0)
+            continue;
 
-        /* check if the character sequence starts with '['
-        *  this character is returned as a sequence after the escape character */
-        if(seq[0] == '[')
+        if(pfd[1].revents & POLLIN)
         {
-            // check for the range of the 2nd sequence character
-            if(seq[1] >= '0' && seq[1] <= '9')
-            {
-                // check the last character of the sequence
-                if(read(STDIN_FILENO, &seq[2], 1) != 1)
-                    // return escape character
-                    return '\x1b';
-                // if the previous if statement didn't match, then check for '~'
-                if(seq[2] == '~')
-                {
-                    // switch case using the 2nd character of the sequence (numbers)
-                    switch(seq[1])
-                    {
-                        case '1':
-                            return HOME_KEY;
-                        case '3':
-                            return DEL_KEY;
-                        case '4':
-                            return END_KEY;
-                        case '5':
-                            return PAGE_UP;
-                        case '6':
-                            return PAGE_DOWN;
-                        case '7':
-                            return HOME_KEY;
-                        case '8':
-                            return END_KEY;
-                    }
-                }
-            }
-            else
+            struct signalfd_siginfo si;
+            int resized = 0;
+            while(read(E.sigfd, &si, sizeof(si)) > 0)
             {
-                // switch case using the 2nd character of the sequence (characters)
-                switch(seq[1])
-                {
-                    case 'A':
-                        return ARROW_UP;
-                    case 'B':
-                        return ARROW_DOWN;
-                    case 'C':
-                        return ARROW_LEFT;
-                    case 'D':
-                        return ARROW_RIGHT;
-                    case 'H':
-                        return HOME_KEY;
-                    case 'F':
-                        return END_KEY;
-                }
+                // another program waits to write the mapped file
+                if(si.ssi_signo == SIGIO)
+                    editorMapPrivate();
+                else
+                    resized = 1;
             }
+            if(resized)
+                editorResize();
+            return SCREEN_UPDATE;
         }
-        else if(seq[0] == 'O')
+        if(pfd[2].revents & POLLIN)
         {
-            // switch case for home and end key
-            switch (seq[1])
-            {
-                case 'H':
-                    return HOME_KEY;
-                case 'F':
-                    return END_KEY;
-            }
+            editorTimerFired();
+            return SCREEN_UPDATE;
+        }
+        // a search running behind the prompt wakes it up with more results
+        if(pfd[3].revents & POLLIN && editorSearchPoll())
+            return SEARCH_UPDATE;
+        // and a save in the background with its progress
+        if(pfd[4].revents & POLLIN && editorSavePoll())
+            return SCREEN_UPDATE;
+        // and rows the workers highlighted with their colors
+        if(pfd[5].revents & POLLIN && editorHighlightPoll())
+            return SCREEN_UPDATE;
+        // and another program writing the file, which is checked at the top
+        if(pfd[6].revents & POLLIN)
+            editorWatchPoll();
+        if(pfd[0].revents)
+        {
+            editorInputFill(0);
+            return 0;
         }
-        return '\x1b';
     }
-    else
+}
+
+/* function that reads in keys: bytes come out of the input buffer, and
+    escape sequences are decoded as CSI (ESC '[' parameters final byte) or
+    SS3 (ESC 'O' byte), anything the editor does not know reads as ESC */
+int editorReadKey()
+{
+    int c, b;
+
+    // events that come before the next key are returned as pseudo keys
+    while(E.inpos == E.inlen)
     {
+        if((c = editorWaitEvent()) != 0)
+            return c;
+    }
+
+    c = E.inbuf[E.inpos++];
+    editorStatsKey();
+    if(c != '\x1b')
         return c;
+
+    // a lone escape is the escape key, so is one another key's sequence follows
+    if((b = editorInputByte(KILO_ESC_TIMEOUT)) == -1)
+        return '\x1b';
+    if(b == '\x1b')
+    {
+        E.inpos--;
+        return '\x1b';
+    }
+
+    if(b == 'O')
+    {
+        // switch case for home and end key
+        switch(editorInputByte(KILO_ESC_TIMEOUT))
+        {
+            case 'H':
+                return HOME_KEY;
+            case 'F':
+                return END_KEY;
+        }
+        return '\x1b';
+    }
+    if(b != '[')
+        return '\x1b';
+
+    // parameter and intermediate bytes run up to the final byte
+    int param = 0, nparams = 0;
+    while((b = editorInputByte(KILO_ESC_TIMEOUT)) != -1 && b >= 0x20 && b <= 0x3f)
+    {
+        if(b >= '0' && b <= '9' && param < 10000)
+            param = param * 10 + b - '0';
+        nparams++;
+    }
+    if(b == -1 || b < 0x40 || b > 0x7e)
+        return '\x1b';
+
+    if(b == '~')
+    {
+        // switch case using the number of the sequence
+        switch(param)
+        {
+            case 1: case 7:
+                return HOME_KEY;
+            case 3:
+                return DEL_KEY;
+            case 4: case 8:
+                return END_KEY;
+            case 5:
+                return PAGE_UP;
+            case 6:
+                return PAGE_DOWN;
+            case 200:
+                editorReadPaste();
+                return PASTE_KEY;
+        }
+        return '\x1b';
     }
+
+    // keys with modifiers carry parameters, plain ones do not
+    if(nparams)
+        return '\x1b';
+    // switch case using the final character of the sequence
+    switch(b)
+    {
+        case 'A':
+            return ARROW_UP;
+        case 'B':
+            return ARROW_DOWN;
+        case 'C':
+            return ARROW_LEFT;
+        case 'D':
+            return ARROW_RIGHT;
+        case 'H':
+            return HOME_KEY;
+        case 'F':
+            return END_KEY;
+    }
+    return '\x1b';
 }
 
 // method to get cursor position
@@ -272,10 +1054,11 @@ int getCursorPosition(int *rows, int *cols)
     if(write(STDOUT_FILENO, "\x1b[6n", 4) != 4)
         return -1;
     
-    // check if i is in buf
+    // check if i is in buf, a terminal that does not reply in time gets no more waiting
     while(i < sizeof(buf) - 1)
     {
-        if(read(STDIN_FILENO, &buf[i], 1) != 1)
+        struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+        if(poll(&pfd, 1, KILO_ESC_TIMEOUT) != 1 || read(STDIN_FILENO, &buf[i], 1) != 1)
             break;
         if(buf[i] == 'R')
             break;
@@ -299,6 +1082,12 @@ int getWindowSize(int *rows, int *cols)
 {
     struct winsize ws;
 
+    if(E.replay)
+    {
+        *rows = E.replay->rows;
+        *cols = E.replay->cols;
+        return 0;
+    }
     if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0)
     {
         // get position of cursor
@@ -317,585 +1106,4854 @@ int getWindowSize(int *rows, int *cols)
 }
 
 
-/* syntax highlighting */
-// function that returns true if the specific character is a 'separtor character'
-int is_separator(int c)
+/* row storage */
+/* Rows are allocated from size classed slabs, and lines read from disk from
+    an arena that is only ever bumped, so loading a file takes a malloc per
+    megabyte instead of several per line, and closing it frees a handful of
+    blocks. It is only used from the UI thread. */
+
+// function that returns the size class of a block of 'size' bytes, -1 if it is too large
+int rowClass(size_t size)
 {
-    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+    int c = 0;
+
+    if(size > KILO_SLAB_MAX)
+        return -1;
+    while((size_t)(KILO_SLAB_MIN << c) < size)
+        c++;
+    return c;
 }
 
-// function that highlights the characters in a row
-void editorUpdateSyntax(erow *row)
+// function that returns how many bytes a block asked for with 'size' really holds
+size_t rowCapacity(size_t size)
 {
-    // variable assignments
-    int i = 0, prev_sep = 1, in_string = 0;
+    int c = rowClass(size);
 
-    // reallocate size
-    row->hl = realloc(row->hl, row->rsize);
-    memset(row->hl, HL_NORMAL, row->rsize);
+    if(c >= 0)
+        return KILO_SLAB_MIN << c;
+    return (size + KILO_SLAB_MAX - 1) & ~(size_t)(KILO_SLAB_MAX - 1);
+}
 
-    // return if no syntax
-    if (E.syntax == NULL)
-        return;
+// function that takes 'size' bytes from malloc for the row storage
+void *rowMalloc(size_t size)
+{
+    void *p = malloc(size);
 
-    // assign syntax to variables
-    char **keywords = E.syntax->keywords;
-    char *scs = E.syntax->singleline_comment_start;
-    char *mcs = E.syntax->multiline_comment_start;
-    char *mce = E.syntax->multiline_comment_end;
-    int scs_len = scs ? strlen(scs) : 0;
-    int mcs_len = mcs ? strlen(mcs) : 0;
-    int mce_len = mce ? strlen(mce) : 0;
-    int in_comment = (row->idx > 0 && E.row[row->idx - 1].hl_open_comment);
-  
-    while(i < row->rsize)
-    {
-        char c = row->render[i];
-        unsigned char prev_hl = (i > 0) ? row->hl[i - 1] : HL_NORMAL;
+    if(p == NULL)
+        die("malloc");
+    E.store.mallocs++;
+    return p;
+}
 
-        // check for singleline comment
-        if(scs_len && !in_string && !in_comment)
-        {
-            if(!strncmp(&row->render[i], scs, scs_len))
-            {
-                // from '//' to the end of the row is a comment
-                memset(&row->hl[i], HL_COMMENT, row->rsize - i);
-                break;
-            }
-        }
+// function that records a slab or arena block so it is freed with the buffer
+void rowAddChunk(char *chunk)
+{
+    struct rowStore *st = &E.store;
 
-        //check for multi line comment(s) 
-        if(mcs_len && mce_len && !in_string)
-        {
-            if(in_comment)
-            {
-                row->hl[i] = HL_MLCOMMENT;
-                if(!strncmp(&row->render[i], mce, mce_len))
-                {
-                    // highlighting to the end of the multi line comment
-                    memset(&row->hl[i], HL_MLCOMMENT, mce_len);
-                    i += mce_len;
-                    in_comment = 0;
-                    prev_sep = 1;
-                    continue;
-                }
-                else
-                {
-                    i++;
-                    continue;
-                }
-            }
-            else if(!strncmp(&row->render[i], mcs, mcs_len))
-            {
-                // start of multiline comment, and starts highlighting
-                memset(&row->hl[i], HL_MLCOMMENT, mcs_len);
-                i += mcs_len;
-                in_comment = 1;
-                continue;
-            }
-        }
+    if(st->nchunks == st->capchunks)
+    {
+        st->capchunks = st->capchunks ? st->capchunks * 2 : 16;
+        st->chunk = realloc(st->chunk, sizeof(char *) * st->capchunks);
+    }
+    st->chunk[st->nchunks++] = chunk;
+}
 
-        if(E.syntax->flags & HL_HIGHLIGHT_STRINGS)
-        {
-            //checking for string
-            if(in_string)
-            {
-                row->hl[i] = HL_STRING;
-                if(c == '\\' && i + 1 < row->rsize)
-                {
-                    row->hl[i + 1] = HL_STRING;
-                    i += 2;
-                    continue;
-                }
+// function that returns a block of rowCapacity(size) bytes
+void *rowAlloc(size_t size)
+{
+    struct rowStore *st = &E.store;
+    int c = rowClass(size);
 
-                if(c == in_string)
-                    in_string = 0;
-                prev_sep = 1;
-                i++;
-                continue;
-            }
-            else
-            {
-                //check for single or double quotes for string
-                if(c == '"' || c == '\'')
-                {
-                    in_string = c;
-                    row->hl[i] = HL_STRING;
-                    i++;
-                    continue;
-                }
-            }
-        }
+    st->blocks++;
+    if(c < 0)
+    {
+        // large blocks sit on a list behind a header, so they can be freed in bulk
+        struct rowBlock *b = rowMalloc(sizeof(struct rowBlock) + rowCapacity(size));
+        if(st->large.next == NULL)
+            st->large.next = st->large.prev = &st->large;
+        b->next = st->large.next;
+        b->prev = &st->large;
+        b->next->prev = b;
+        st->large.next = b;
+        st->large_bytes += rowCapacity(size);
+        return b + 1;
+    }
 
-        // handling highlighting numbers
-        if(E.syntax->flags & HL_HIGHLIGHT_NUMBERS)
+    // an empty class gets a new slab cut into blocks of its size
+    if(st->free[c] == NULL)
+    {
+        size_t bs = KILO_SLAB_MIN << c;
+        char *slab = rowMalloc(KILO_SLAB_CHUNK);
+        rowAddChunk(slab);
+        st->slab_bytes += KILO_SLAB_CHUNK;
+        for(size_t off = KILO_SLAB_CHUNK; off >= bs; off -= bs)
         {
-            if ((isdigit(c) && (prev_sep || prev_hl == HL_NUMBER)) ||
-                    (c == '.' && prev_hl == HL_NUMBER))
-            {
-                row->hl[i] = HL_NUMBER;
-                prev_sep = 0;
-                i++;
-                continue;
-            }
+            *(void **)(slab + off - bs) = st->free[c];
+            st->free[c] = slab + off - bs;
         }
+    }
+    void *p = st->free[c];
+    st->free[c] = *(void **)p;
+    return p;
+}
 
-        //checking for separator character
-        if(prev_sep)
-        {
-            int j;
-            // looping through keywords
-            for(j = 0; keywords[j]; j++)
-            {
-                int klen = strlen(keywords[j]);
-                int kw2 = keywords[j][klen - 1] == '|';
-
-                if(kw2)
-                    klen--;
+// function that gives back a block, 'size' is what it was asked for with or its capacity
+void rowFree(void *p, size_t size)
+{
+    struct rowStore *st = &E.store;
+    int c = rowClass(size);
 
-                if(!strncmp(&row->render[i], keywords[j], klen) &&
-                        is_separator(row->render[i + klen]))
-                {
-                    // handling keywords
-                    memset(&row->hl[i], kw2 ? HL_KEYWORD2 : HL_KEYWORD1, klen);
-                    i += klen;
-                    break;
-                }
-            }
+    if(p == NULL)
+        return;
+    st->blocks--;
+    if(c < 0)
+    {
+        struct rowBlock *b = (struct rowBlock *)p - 1;
+        b->prev->next = b->next;
+        b->next->prev = b->prev;
+        st->large_bytes -= rowCapacity(size);
+        free(b);
+        return;
+    }
+    *(void **)p = st->free[c];
+    st->free[c] = p;
+}
 
-            // keyword was a match since it is not null
-            if(keywords[j] != NULL)
-            {
-                prev_sep = 0;
-                continue;
-            }
-        }
+// function that moves a block to one for 'size' bytes if its capacity differs, keeping what fits
+void *rowResize(void *p, size_t oldsize, size_t size)
+{
+    if(p && rowCapacity(oldsize) == rowCapacity(size))
+        return p;
 
-        // passing char c to check if it is a separator character
-        prev_sep = is_separator(c);
-        i++;
+    void *q = rowAlloc(size);
+    if(p)
+    {
+        memcpy(q, p, oldsize < size ? oldsize : size);
+        rowFree(p, oldsize);
     }
+    return q;
+}
+
+// function that returns 'size' bytes of the arena, they are only freed with the buffer
+char *rowArenaAlloc(size_t size)
+{
+    struct rowStore *st = &E.store;
 
-    int changed = (row->hl_open_comment != in_comment);
-    row->hl_open_comment = in_comment;
-    // check for open comment and apply syntax to next row if necessary
-    if(changed && row->idx + 1 < E.numrows)
-        editorUpdateSyntax(&E.row[row->idx + 1]);
+    if(size > KILO_ARENA_BLOCK / 4)
+    {
+        char *p = rowMalloc(size);
+        rowAddChunk(p);
+        st->arena_bytes += size;
+        return p;
+    }
+    if(st->arena_left < size)
+    {
+        st->arena = rowMalloc(KILO_ARENA_BLOCK);
+        st->arena_left = KILO_ARENA_BLOCK;
+        rowAddChunk(st->arena);
+        st->arena_bytes += KILO_ARENA_BLOCK;
+    }
+    char *p = st->arena;
+    st->arena += size;
+    st->arena_left -= size;
+    return p;
 }
 
-//function that maps highlight values to colors
-int editorSyntaxToColor(int hl)
+// function that frees all the row storage at once, every row allocated from it goes with it
+void rowStoreFree()
 {
-    // switch case for highlighting, each case is a different color
-    switch(hl)
+    struct rowStore *st = &E.store;
+    int i;
+
+    for(i = 0; i < st->nchunks; i++)
+        free(st->chunk[i]);
+    free(st->chunk);
+    if(st->large.next)
     {
-        case HL_NUMBER:
-            return 31;
-        case HL_KEYWORD2:
-            return 32;
-        case HL_KEYWORD1:
-            return 33;
-        case HL_MATCH:
-            return 34;
-        case HL_STRING:
-            return 35;
-        case HL_COMMENT: case HL_MLCOMMENT:
-            return 36;
-        default:
-            return 37;
+        struct rowBlock *b = st->large.next;
+        while(b != &st->large)
+        {
+            struct rowBlock *next = b->next;
+            free(b);
+            b = next;
+        }
     }
+    memset(st, 0, sizeof(*st));
 }
 
-//function that matches filename to filematch
-void editorSelectSyntaxHighlight()
+// function that shows the resident size of the editor and what the row storage holds
+void rowStoreStats()
 {
-    // set syntax to null
-    E.syntax = NULL;
+    struct rowStore *st = &E.store;
+    double mb = 1024.0 * 1024.0;
 
-    // return if file name is empty
-    if(E.filename == NULL)
-        return;
+    editorSetStatusMessage("%.1f MB RSS, store %.1f MB in %ld mallocs for %ld blocks "
+            "(%.1f MB arena)", editorRss() / mb,
+            (st->slab_bytes + st->arena_bytes + st->large_bytes) / mb,
+            (long)st->mallocs, (long)st->blocks, st->arena_bytes / mb);
+}
 
-    char *ext = strrchr(E.filename, '.');
 
-    // select the highlighting syntax
-    for(unsigned int j = 0; j < HLDB_ENTRIES; j++)
+/* row tree */
+// function that returns the number of rows in a subtree
+int rowTreeCount(struct rownode *n)
+{
+    return n ? n->count : 0;
+}
+
+// function that returns the number of rows a single node stands for
+int rowTreeSelf(struct rownode *n)
+{
+    return n->span ? n->span : 1;
+}
+
+// function that recomputes a node's row count and reattaches its children
+void rowTreeUpdate(struct rownode *n)
+{
+    n->count = rowTreeCount(n->left) + rowTreeCount(n->right) + rowTreeSelf(n);
+    if(n->left)
+        n->left->parent = n;
+    if(n->right)
+        n->right->parent = n;
+}
+
+// function that returns a pseudo random priority for a new node
+unsigned int rowTreePriority()
+{
+    static unsigned int state = 2463534242u;
+
+    // xorshift32
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// function that allocates a detached node
+struct rownode *rowTreeNode(int first, int span)
+{
+    struct rownode *n = rowAlloc(sizeof(struct rownode));
+
+    n->left = n->right = n->parent = NULL;
+    n->prio = rowTreePriority();
+    n->first = first;
+    n->span = span;
+    n->count = rowTreeSelf(n);
+    return n;
+}
+
+/* function that splits a tree into its first 'at' rows and the rest,
+    'at' must fall on a node boundary */
+void rowTreeSplit(struct rownode *n, int at, struct rownode **l,
+        struct rownode **r)
+{
+    if(n == NULL)
     {
-        struct editorSyntax *s = &HLDB[j];
-        unsigned int i = 0;
-        while(s->filematch[i])
-        {   
-            //check for file match
-            int is_ext = (s->filematch[i][0] == '.');
-            if((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
-                    (!is_ext && strstr(E.filename, s->filematch[i])))
-            {
-                // set syntax to s
-                E.syntax = s;
-                for(int filerow = 0; filerow < E.numrows; filerow++)
-                {
-                    editorUpdateSyntax(&E.row[filerow]);
-                }
+        *l = *r = NULL;
+        return;
+    }
 
-                return;
-            }
-            i++;
-        }
+    n->parent = NULL;
+    if(rowTreeCount(n->left) < at)
+    {
+        rowTreeSplit(n->right, at - rowTreeCount(n->left) - rowTreeSelf(n),
+                &n->right, r);
+        *l = n;
+    }
+    else
+    {
+        rowTreeSplit(n->left, at, l, &n->left);
+        *r = n;
     }
+    rowTreeUpdate(n);
 }
 
+// function that joins two trees, every row of 'l' comes before 'r'
+struct rownode *rowTreeMerge(struct rownode *l, struct rownode *r)
+{
+    if(l == NULL)
+        return r;
+    if(r == NULL)
+        return l;
 
-/* row operations */
-// function to change character index
-int editorRowCxToRx(erow *row, int cx)
+    if(l->prio > r->prio)
+    {
+        l->right = rowTreeMerge(l->right, r);
+        rowTreeUpdate(l);
+        l->parent = NULL;
+        return l;
+    }
+    r->left = rowTreeMerge(l, r->left);
+    rowTreeUpdate(r);
+    r->parent = NULL;
+    return r;
+}
+
+// function that returns the index of the first row a node stands for
+int rowTreeRank(struct rownode *n)
 {
-    //variable declaration/initialization
-    int j, rx = 0;
-    
-    // convert character index to render index
-    for(j = 0; j < cx; j++)
+    int idx = rowTreeCount(n->left);
+
+    while(n->parent)
     {
-        if(row->chars[j] == '\t')
-            rx += (KILO_TAB_STOP - 1) - (rx % KILO_TAB_STOP);
-        rx++;
+        if(n == n->parent->right)
+            idx += rowTreeCount(n->parent->left) + rowTreeSelf(n->parent);
+        n = n->parent;
     }
-    return rx;
+    return idx;
 }
 
-// function to change character index
-int editorRowRxToCx(erow *row, int rx)
+// function that returns the first node of the tree
+struct rownode *rowTreeFirst()
 {
-    //variable declaration/initialization
-    int cx, cur_rx = 0;
+    struct rownode *n = E.rows;
 
-    // convert render index back to character index
-    for(cx = 0; cx < row->size; cx++)
+    while(n && n->left)
+        n = n->left;
+    return n;
+}
+
+// function that returns the node after 'n' without loading anything
+struct rownode *rowTreeNext(struct rownode *n)
+{
+    if(n->right)
     {
-        if(row->chars[cx] == '\t')
-            cur_rx += (KILO_TAB_STOP - 1) - (cur_rx % KILO_TAB_STOP);
-        cur_rx++;
-        if(cur_rx > rx)
-            return cx;
+        n = n->right;
+        while(n->left)
+            n = n->left;
+        return n;
     }
-    
-    return cx;
+    while(n->parent && n == n->parent->right)
+        n = n->parent;
+    return n->parent;
 }
 
-//function that updates render array when current row changes
-void editorUpdateRow(erow *row)
+// function that returns the node before 'n' without loading anything
+struct rownode *rowTreePrev(struct rownode *n)
 {
-    //variable declaration/initialization
-    int j, idx = 0, tabs = 0;
+    if(n->left)
+    {
+        n = n->left;
+        while(n->right)
+            n = n->right;
+        return n;
+    }
+    while(n->parent && n == n->parent->left)
+        n = n->parent;
+    return n->parent;
+}
 
-    // check for tabs
-    for(j = 0; j < row->size; j++)
-        if(row->chars[j] == '\t')
-            tabs++;
-    
-    // free and allocate space for rendered row
-    free(row->render);
-    row->render = malloc(row->size + tabs*(KILO_TAB_STOP - 1) + 1);
-    
-    // iterate through row characters
-    for(j = 0; j < row->size; j++)
+// function that returns line 'line' of the mapped file, minus its line ending
+const char *editorMapLine(int line, int *len)
+{
+    const char *s = E.map + E.lineoff[line];
+    int n = E.lineoff[line + 1] - E.lineoff[line] - 1;
+
+    while(n > 0 && s[n - 1] == '\r')
+        n--;
+    *len = n;
+    return s;
+}
+
+/* function that turns line 'k' of a span node into a row of its own, the
+    lines before and after it stay behind in new span nodes */
+erow *rowTreeLoad(struct rownode *n, int k)
+{
+    int start = rowTreeRank(n), first = n->first, span = n->span;
+    struct rownode *l, *m, *r;
+
+    // cut the span node out of the tree
+    rowTreeSplit(E.rows, start, &l, &m);
+    rowTreeSplit(m, span, &m, &r);
+
+    if(k > 0)
+        l = rowTreeMerge(l, rowTreeNode(first, k));
+    if(k < span - 1)
+        r = rowTreeMerge(rowTreeNode(first + k + 1, span - k - 1), r);
+
+    // the row borrows its characters from the mapping until it is edited
+    erow *row = &n->row;
+    row->chars = (char *)editorMapLine(first + k, &row->size);
+    row->borrowed = 1;
+    row->cap = 0;
+    row->save_gen = 0;
+    row->rsize = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    row->tabbed = 0;
+    row->rxmark = NULL;
+    row->nrxmark = row->caprxmark = 0;
+    row->wide = NULL;
+    row->hl_open_comment = 0;
+    row->hl_gen = 0;
+    row->hl_defer = 0;
+    n->span = 0;
+    rowTreeUpdate(n);
+
+    E.rows = rowTreeMerge(rowTreeMerge(l, n), r);
+    editorRenderRow(row);
+    return row;
+}
+
+// function that returns the node holding row '*at' and its offset in the node
+struct rownode *rowTreeFind(int *at)
+{
+    struct rownode *n = E.rows;
+
+    // walk down using the subtree counts
+    while(n)
     {
-        if(row->chars[j] == '\t')
+        int left = rowTreeCount(n->left);
+        if(*at < left)
         {
-            row->render[idx++] = ' ';
-            while(idx % KILO_TAB_STOP != 0)
-                row->render[idx++] = ' ';
+            n = n->left;
+        }
+        else if(*at < left + rowTreeSelf(n))
+        {
+            *at -= left;
+            break;
         }
         else
         {
-            row->render[idx++] = row->chars[j];
+            *at -= left + rowTreeSelf(n);
+            n = n->right;
         }
     }
-    // set render[idx] to null and update hightlighting syntax for the row
-    row->render[idx] = '\0';
-    row->rsize = idx;
-    editorUpdateSyntax(row);
+    return n;
 }
 
-// function to insert row
-void editorInsertRow(int at, char *s, size_t len)
+// function that returns the row at index 'at'
+erow *editorRowAt(int at)
 {
-    if(at < 0 || at > E.numrows)
-        return;
-    // reallocate more space and increase row count
-    E.row = realloc(E.row, sizeof(erow) * (E.numrows + 1));
-    memmove(&E.row[at + 1], &E.row[at], sizeof(erow) * (E.numrows - at));
-    for(int j = at + 1; j <= E.numrows; j++)
-        E.row[j].idx++;
+    if(at < 0 || at >= E.numrows)
+        return NULL;
 
-    // assign new values to struct variables
-    E.row[at].idx = at;
-    E.row[at].size = len;
-    E.row[at].chars = malloc(len + 1);
-    memcpy(E.row[at].chars, s, len);
-    E.row[at].chars[len] = '\0';
-    E.row[at].rsize = 0;
-    E.row[at].render = NULL;
-    E.row[at].hl = NULL;
-    E.row[at].hl_open_comment = 0;
-    //call function and pass row[at]
-    editorUpdateRow(&E.row[at]);
-    //increment row count and modified buffer
-    E.numrows++;
-    E.dirty++;
+    struct rownode *n = rowTreeFind(&at);
+    if(n->span)
+        return rowTreeLoad(n, at);
+    return &n->row;
 }
 
-// function to free up space
-void editorFreeRow(erow *row)
+// function that derives the index of a row from its position in the tree
+int editorRowIndex(erow *row)
 {
-    free(row->render);
-    free(row->chars);
-    free(row->hl);
+    return rowTreeRank((struct rownode *)row);
 }
 
-//function to remove row
-void editorDelRow(int at)
+// function that returns the row after 'row', or NULL at the end
+erow *editorRowNext(erow *row)
 {
-    if(at < 0 || at >= E.numrows)
-        return;
+    struct rownode *n = rowTreeNext((struct rownode *)row);
 
-    // free row space and delete row, moving the other rows up by 1
-    editorFreeRow(&E.row[at]);
-    memmove(&E.row[at], &E.row[at + 1], sizeof(erow) * (E.numrows - at - 1));
-    for(int j = at; j < E.numrows - 1; j++)
-        E.row[j].idx--;
-    // decrement row count and increment modified buffer
-    E.numrows--;
-    E.dirty++;
+    if(n && n->span)
+        return rowTreeLoad(n, 0);
+    return n ? &n->row : NULL;
 }
 
-//function to insert characters at cursor position
-void editorRowInsertChar(erow *row, int at, int c)
+// function that returns the row before 'row', or NULL at the start
+erow *editorRowPrev(erow *row)
 {
-    // set at equal to row size
-    if(at < 0 || at > row->size)
-        at = row->size;
-    // allocate space for row characters
-    row->chars = realloc(row->chars, row->size + 2);
-    memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
-    // increase row size
-    row->size++;
-    // set char[at] to character 'c'
-    row->chars[at] = c;
-    // call function to update row
-    editorUpdateRow(row);
-    // modified buffer
-    E.dirty++;
-}
+    struct rownode *n = rowTreePrev((struct rownode *)row);
 
-// function to append a string to current row
-void editorRowAppendString(erow *row, char *s, size_t len)
-{
-    row->chars = realloc(row->chars, row->size + len + 1);
-    // append string 's' to end of current row
-    memcpy(&row->chars[row->size], s, len);
-    // update row size
-    row->size += len;
-    // set null term for end of row
-    row->chars[row->size] = '\0';
-    //update row
-    editorUpdateRow(row);
-    //modified buffer
-    E.dirty++;
+    if(n && n->span)
+        return rowTreeLoad(n, n->span - 1);
+    return n ? &n->row : NULL;
 }
 
-// function to delete character in row
-void editorRowDelChar(erow *row, int at)
+// function that returns the text of row 'at' without loading it
+int editorRowPeek(int at, const char **s)
 {
-    if(at < 0 || at >= row->size)
-        return;
-    // delete character at [at +1] and decrement row size
-    memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
-    row->size--;
-    //update row
-    editorUpdateRow(row);
-    //modified buffer
-    E.dirty++;
+    struct rownode *n = rowTreeFind(&at);
+    int len;
+
+    if(n->span)
+    {
+        *s = editorMapLine(n->first + at, &len);
+        return len;
+    }
+    editorRowFlat(&n->row);
+    *s = n->row.chars;
+    return n->row.size;
 }
 
 
-/* editor operations */
+/* syntax highlighting */
+// function that returns true if the specific character is a 'separtor character'
+int is_separator(int c)
+{
+    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];", c) != NULL;
+}
+
+// function that fills in the character class table of a syntax
+void editorCompileClasses(struct editorSyntax *syn)
+{
+    unsigned char *cls = malloc(256);
+    char *delims[2] = { syn->singleline_comment_start,
+            syn->multiline_comment_start };
+    int c;
+
+    for(c = 0; c < 256; c++)
+    {
+        cls[c] = 0;
+        if(is_separator(c))
+            cls[c] |= HLC_SEP;
+        if(isdigit(c))
+            cls[c] |= HLC_DIGIT;
+        if((syn->flags & HL_HIGHLIGHT_STRINGS) && (c == '"' || c == '\''))
+            cls[c] |= HLC_QUOTE;
+    }
+    for(c = 0; c < 2; c++)
+        if(delims[c] && delims[c][0])
+            cls[(unsigned char)delims[c][0]] |= HLC_DELIM;
+
+    // the vector scan assumes word characters never stop a run
+    syn->cclass_simd = !(cls['_'] & HLC_STOP);
+    for(c = 0; c < 256; c++)
+        if((isalpha(c) || c >= 0x80) && (cls[c] & HLC_STOP))
+            syn->cclass_simd = 0;
+    syn->cclass = cls;
+}
+
+/* function that returns the index of the first byte in s[i..len) equal to
+    one of the 'n' (1 to 4) bytes of 'set', or 'len' if there is none */
+int editorScanAny(const char *s, int i, int len, const char *set, int n)
+{
+#if defined(__AVX2__) || defined(__SSE2__)
+    char b = set[n > 1 ? 1 : 0], c = set[n > 2 ? 2 : 0], d = set[n - 1];
+#endif
+#if defined(__AVX2__)
+    __m256i wa = _mm256_set1_epi8(set[0]), wb = _mm256_set1_epi8(b);
+    __m256i wc = _mm256_set1_epi8(c), wd = _mm256_set1_epi8(d);
+
+    // compare 32 bytes at a time against every byte of the set
+    while(i + 32 <= len)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i m = _mm256_or_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, wa), _mm256_cmpeq_epi8(v, wb)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(v, wc), _mm256_cmpeq_epi8(v, wd)));
+        unsigned int bits = _mm256_movemask_epi8(m);
+        if(bits)
+            return i + __builtin_ctz(bits);
+        i += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i va = _mm_set1_epi8(set[0]), vb = _mm_set1_epi8(b);
+    __m128i vc = _mm_set1_epi8(c), vd = _mm_set1_epi8(d);
+
+    // compare 16 bytes at a time against every byte of the set
+    while(i + 16 <= len)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i m = _mm_or_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)),
+                _mm_or_si128(_mm_cmpeq_epi8(v, vc), _mm_cmpeq_epi8(v, vd)));
+        unsigned int bits = _mm_movemask_epi8(m);
+        if(bits)
+            return i + __builtin_ctz(bits);
+        i += 16;
+    }
+#endif
+    // scalar tail, and the whole scan on other machines
+    for(; i < len; i++)
+        if(memchr(set, s[i], n))
+            return i;
+    return len;
+}
+
+/* function that skips a run of ordinary characters, returning the index of
+    the first one whose class has a HLC_STOP bit, or 'len' */
+int editorScanClass(struct editorSyntax *syn, const char *s, int i, int len)
+{
+    const unsigned char *cls = syn->cclass;
+
+    /* letters, '_' and bytes >= 0x80 are skipped whole vectors at a time, any
+        other byte is looked up in the table */
+#if defined(__AVX2__)
+    if(syn->cclass_simd)
+    {
+        const __m256i fold = _mm256_set1_epi8(0x20), bias = _mm256_set1_epi8(31);
+        const __m256i limit = _mm256_set1_epi8(-102), under = _mm256_set1_epi8('_');
+        const __m256i zero = _mm256_setzero_si256();
+
+        while(i + 32 <= len)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+            // (v | 0x20) - 'a' < 26 as an unsigned compare finds the letters
+            __m256i alpha = _mm256_cmpgt_epi8(limit,
+                    _mm256_add_epi8(_mm256_or_si256(v, fold), bias));
+            __m256i plain = _mm256_or_si256(_mm256_or_si256(alpha,
+                    _mm256_cmpgt_epi8(zero, v)), _mm256_cmpeq_epi8(v, under));
+            unsigned int bits = ~(unsigned int)_mm256_movemask_epi8(plain);
+            if(bits == 0)
+            {
+                i += 32;
+                continue;
+            }
+            i += __builtin_ctz(bits);
+            if(cls[(unsigned char)s[i]] & HLC_STOP)
+                return i;
+            i++;
+        }
+    }
+#endif
+#if defined(__SSE2__)
+    if(syn->cclass_simd)
+    {
+        const __m128i fold = _mm_set1_epi8(0x20), bias = _mm_set1_epi8(31);
+        const __m128i limit = _mm_set1_epi8(-102), under = _mm_set1_epi8('_');
+        const __m128i zero = _mm_setzero_si128();
+
+        while(i + 16 <= len)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+            // (v | 0x20) - 'a' < 26 as an unsigned compare finds the letters
+            __m128i alpha = _mm_cmplt_epi8(
+                    _mm_add_epi8(_mm_or_si128(v, fold), bias), limit);
+            __m128i plain = _mm_or_si128(_mm_or_si128(alpha,
+                    _mm_cmplt_epi8(v, zero)), _mm_cmpeq_epi8(v, under));
+            unsigned int bits = ~_mm_movemask_epi8(plain) & 0xffff;
+            if(bits == 0)
+            {
+                i += 16;
+                continue;
+            }
+            i += __builtin_ctz(bits);
+            if(cls[(unsigned char)s[i]] & HLC_STOP)
+                return i;
+            i++;
+        }
+    }
+#endif
+    while(i < len && !(cls[(unsigned char)s[i]] & HLC_STOP))
+        i++;
+    return i;
+}
+
+// function that hashes a word for the keyword table
+unsigned int editorKeywordHash(const char *s, int len, unsigned int seed)
+{
+    unsigned int h = 2166136261u ^ seed;
+
+    // FNV-1a
+    for(int i = 0; i < len; i++)
+    {
+        h ^= (unsigned char)s[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+/* function that compiles a keyword list into a table where every keyword has
+    a slot of its own, so matching a word is one hash and one compare.
+    Keywords must not contain separator characters. */
+struct editorKeywords *editorCompileKeywords(char **keywords)
+{
+    struct editorKeywords *kw = malloc(sizeof(struct editorKeywords));
+    unsigned int size = 8, seed;
+    int j, n = 0;
+
+    for(j = 0; keywords[j]; j++)
+        n++;
+    while(size < (unsigned int)n * 2)
+        size *= 2;
+
+    kw->slot = NULL;
+
+    // look for a seed that gives every keyword its own slot, growing if needed
+    while(1)
+    {
+        kw->slot = realloc(kw->slot, sizeof(struct editorKeyword) * size);
+        for(seed = 0; seed < 256; seed++)
+        {
+            memset(kw->slot, 0, sizeof(struct editorKeyword) * size);
+            kw->minlen = n ? 0x7fffffff : 1;
+            kw->maxlen = 0;
+            for(j = 0; keywords[j]; j++)
+            {
+                int klen = strlen(keywords[j]);
+                int kw2 = keywords[j][klen - 1] == '|';
+                if(kw2)
+                    klen--;
+
+                struct editorKeyword *e = &kw->slot[editorKeywordHash(
+                        keywords[j], klen, seed) & (size - 1)];
+                if(e->word)
+                {
+                    // an earlier duplicate wins, like the list order did
+                    if(e->len == klen && !memcmp(e->word, keywords[j], klen))
+                        continue;
+                    break;
+                }
+                e->word = keywords[j];
+                e->len = klen;
+                e->type = kw2 ? HL_KEYWORD2 : HL_KEYWORD1;
+                if(klen < kw->minlen)
+                    kw->minlen = klen;
+                if(klen > kw->maxlen)
+                    kw->maxlen = klen;
+            }
+            if(keywords[j] == NULL)
+            {
+                kw->mask = size - 1;
+                kw->seed = seed;
+                return kw;
+            }
+        }
+        size *= 2;
+    }
+}
+
+// function that returns the highlight type of a keyword, or 0 for other words
+int editorKeywordLookup(struct editorKeywords *kw, const char *s, int len)
+{
+    if(len < kw->minlen || len > kw->maxlen)
+        return 0;
+
+    struct editorKeyword *e = &kw->slot[editorKeywordHash(s, len, kw->seed) &
+            kw->mask];
+    if(e->word && e->len == len && !memcmp(e->word, s, len))
+        return e->type;
+    return 0;
+}
+
+/* function that highlights s[from..) into hl from state 'st' until it gets to
+    'stop', and returns where it stopped with the state there left in 'st'.
+    Nothing past 'stop' is decided, but delimiters and keywords starting
+    before it may be read up to 'len'. */
+int editorHighlight(struct editorSyntax *syn, const char *s, int from, int len,
+        unsigned char *hl, struct hlState *st, int stop)
+{
+    // variable assignments
+    int i = from, prev_sep = st->prev_sep, in_string = st->in_string;
+    int in_comment = st->in_comment;
+
+    // the rest of the line is a single line comment
+    if(st->rest)
+    {
+        memset(&hl[i], HL_COMMENT, len - i);
+        return len;
+    }
+
+    // assign syntax to variables
+    const unsigned char *cls = syn->cclass;
+    char *scs = syn->singleline_comment_start;
+    char *mcs = syn->multiline_comment_start;
+    char *mce = syn->multiline_comment_end;
+    int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
+  
+    while(i < stop)
+    {
+        char c = s[i];
+        unsigned char cc = cls[(unsigned char)c];
+        unsigned char prev_hl = (i > from) ? hl[i - 1] : st->prev_hl;
+
+        // inside a multi line comment, jump to the next possible end of it
+        if(in_comment && mcs_len && mce_len)
+        {
+            int j = editorScanAny(s, i, stop, mce, 1);
+            memset(&hl[i], HL_MLCOMMENT, j - i);
+            i = j;
+            if(i >= stop)
+                break;
+            if(i + mce_len <= len && !memcmp(&s[i], mce, mce_len))
+            {
+                // highlighting to the end of the multi line comment
+                memset(&hl[i], HL_MLCOMMENT, mce_len);
+                i += mce_len;
+                in_comment = 0;
+                prev_sep = 1;
+            }
+            else
+            {
+                hl[i++] = HL_MLCOMMENT;
+            }
+            continue;
+        }
+
+        // inside a string, jump to the next quote or escape
+        if(in_string)
+        {
+            char quote[2] = { in_string, '\\' };
+            int j = editorScanAny(s, i, stop, quote, 2);
+            memset(&hl[i], HL_STRING, j - i);
+            prev_sep = 1;
+            i = j;
+            if(i >= stop)
+                break;
+
+            hl[i] = HL_STRING;
+            if(s[i] == '\\' && i + 1 < len)
+            {
+                hl[i + 1] = HL_STRING;
+                i += 2;
+                continue;
+            }
+            if(s[i] == in_string)
+                in_string = 0;
+            i++;
+            continue;
+        }
+
+        // the rest of a word cannot start anything, skip to where it ends
+        if(!prev_sep && !(cc & HLC_STOP))
+        {
+            i = editorScanClass(syn, s, i, stop);
+            continue;
+        }
+
+        if(cc & HLC_DELIM)
+        {
+            // check for singleline comment
+            if(scs_len && i + scs_len <= len && !memcmp(&s[i], scs, scs_len))
+            {
+                // from '//' to the end of the row is a comment
+                memset(&hl[i], HL_COMMENT, len - i);
+                st->rest = 1;
+                i = len;
+                break;
+            }
+
+            //check for the start of a multi line comment
+            if(mcs_len && mce_len && i + mcs_len <= len &&
+                    !memcmp(&s[i], mcs, mcs_len))
+            {
+                // start of multiline comment, and starts highlighting
+                memset(&hl[i], HL_MLCOMMENT, mcs_len);
+                i += mcs_len;
+                in_comment = 1;
+                continue;
+            }
+        }
+
+        //check for single or double quotes for string
+        if(cc & HLC_QUOTE)
+        {
+            in_string = c;
+            hl[i] = HL_STRING;
+            i++;
+            continue;
+        }
+
+        // handling highlighting numbers
+        if(syn->flags & HL_HIGHLIGHT_NUMBERS)
+        {
+            if(((cc & HLC_DIGIT) && (prev_sep || prev_hl == HL_NUMBER)) ||
+                    (c == '.' && prev_hl == HL_NUMBER))
+            {
+                hl[i] = HL_NUMBER;
+                prev_sep = 0;
+                i++;
+                continue;
+            }
+        }
+
+        //checking for separator character
+        if(prev_sep)
+        {
+            // a keyword has to be the whole word up to the next separator
+            int klen = 0;
+            while(i + klen < len && !(cls[(unsigned char)s[i + klen]] & HLC_SEP))
+                klen++;
+
+            int type = editorKeywordLookup(syn->kwtab, &s[i], klen);
+            if(type)
+            {
+                // handling keywords
+                memset(&hl[i], type, klen);
+                i += klen;
+                prev_sep = 0;
+                continue;
+            }
+        }
+
+        // passing char c to check if it is a separator character
+        prev_sep = (cc & HLC_SEP) != 0;
+        i++;
+    }
+
+    st->in_comment = in_comment;
+    st->in_string = in_string;
+    st->prev_sep = prev_sep;
+    if(i > from)
+        st->prev_hl = hl[i - 1];
+    return i;
+}
+
+/* function that highlights the characters in a row, 'in_comment' is the
+    multiline comment state the row starts in */
+void editorUpdateSyntax(erow *row, int in_comment)
+{
+    struct hlState st = { in_comment, 0, 1, HL_NORMAL, 0 };
+    int told = row->hl_open_comment;
+
+    E.stats.highlights++;
+    row->hl_in = in_comment;
+    row->hl_gen = E.hl_gen;
+    // a wide row is highlighted a window at a time, here it only learns its end state
+    if(row->wide)
+    {
+        row->hl_open_comment = editorRowScan(row, in_comment);
+        row->wide->nmark = 0;
+        editorSyntaxSettle(row, told);
+        return;
+    }
+
+    // rows without tabs only get hl once it is needed
+    if(row->hl == NULL)
+        row->hl = rowAlloc(row->rsize);
+    memset(row->hl, HL_NORMAL, row->rsize);
+    row->hl_open_comment = 0;
+
+    // return if no syntax
+    if (E.syntax == NULL)
+    {
+        editorSyntaxSettle(row, told);
+        return;
+    }
+
+    editorHighlight(E.syntax, row->render, 0, row->rsize, row->hl, &st, row->rsize);
+    row->hl_open_comment = st.in_comment;
+    editorSyntaxSettle(row, told);
+}
+
+/* function that only follows comments and strings through a line to find
+    the multiline comment state it ends in, it agrees with editorUpdateSyntax
+    without building the hl array */
+int editorSyntaxScan(const char *s, int len, int in_comment)
+{
+    int i = 0, in_string = 0, nstop = 0;
+    char stop[4], quote[2];
+
+    if(E.syntax == NULL)
+        return 0;
+
+    char *scs = E.syntax->singleline_comment_start;
+    char *mcs = E.syntax->multiline_comment_start;
+    char *mce = E.syntax->multiline_comment_end;
+    int scs_len = scs ? strlen(scs) : 0;
+    int mcs_len = mcs ? strlen(mcs) : 0;
+    int mce_len = mce ? strlen(mce) : 0;
+    int strings = E.syntax->flags & HL_HIGHLIGHT_STRINGS;
+
+    if(!mcs_len || !mce_len)
+        return 0;
+
+    // outside comments and strings only these bytes can change the state
+    stop[nstop++] = mcs[0];
+    if(scs_len)
+        stop[nstop++] = scs[0];
+    if(strings)
+    {
+        stop[nstop++] = '"';
+        stop[nstop++] = '\'';
+    }
+
+    while(i < len)
+    {
+        if(in_comment)
+        {
+            // look for the end of the comment
+            i = editorScanAny(s, i, len, mce, 1);
+            if(i + mce_len <= len && !memcmp(&s[i], mce, mce_len))
+            {
+                i += mce_len;
+                in_comment = 0;
+            }
+            else
+            {
+                i++;
+            }
+        }
+        else if(in_string)
+        {
+            // skip escaped characters inside strings
+            quote[0] = in_string;
+            quote[1] = '\\';
+            i = editorScanAny(s, i, len, quote, 2);
+            if(i >= len)
+                break;
+            if(s[i] == '\\' && i + 1 < len)
+            {
+                i += 2;
+                continue;
+            }
+            if(s[i] == in_string)
+                in_string = 0;
+            i++;
+        }
+        else if((i = editorScanAny(s, i, len, stop, nstop)) >= len)
+        {
+            break;
+        }
+        else if(scs_len && i + scs_len <= len && !memcmp(&s[i], scs, scs_len))
+        {
+            // the rest of the row is a single line comment
+            break;
+        }
+        else if(i + mcs_len <= len && !memcmp(&s[i], mcs, mcs_len))
+        {
+            i += mcs_len;
+            in_comment = 1;
+        }
+        else
+        {
+            if(strings && (s[i] == '"' || s[i] == '\''))
+                in_string = s[i];
+            i++;
+        }
+    }
+    return in_comment;
+}
+
+// function that returns the comment state a node's row 'k' ends in
+int editorSyntaxLineState(struct rownode *n, int k, int in_comment)
+{
+    const char *s;
+    int len;
+
+    if(n->span)
+    {
+        s = editorMapLine(n->first + k, &len);
+        return editorSyntaxScan(s, len, in_comment);
+    }
+    // a row that is already highlighted for this state knows the answer
+    if(n->row.hl_in == in_comment && n->row.hl_gen == E.hl_gen)
+        return n->row.hl_open_comment;
+    return editorRowScan(&n->row, in_comment);
+}
+
+/* function that returns the multiline comment state row 'at' starts in,
+    resuming from the nearest checkpoint and saving new ones on the way */
+int editorSyntaxStateAt(int at)
+{
+    if(E.syntax == NULL || !E.syntax->multiline_comment_start ||
+            !E.syntax->multiline_comment_end || at <= 0)
+        return 0;
+
+    // the first row always starts outside a comment
+    if(E.hlcp_len == 0)
+    {
+        if(E.hlcp_cap == 0)
+        {
+            E.hlcp_cap = 64;
+            E.hlcp = malloc(E.hlcp_cap);
+        }
+        E.hlcp[0] = 0;
+        E.hlcp_len = 1;
+    }
+
+    int cp = at / KILO_HL_CHECKPOINT;
+    if(cp >= E.hlcp_len)
+        cp = E.hlcp_len - 1;
+
+    int filerow = cp * KILO_HL_CHECKPOINT, k = filerow;
+    int state = E.hlcp[cp];
+    struct rownode *n = rowTreeFind(&k);
+
+    // walk forward line by line until row 'at'
+    while(filerow < at)
+    {
+        state = editorSyntaxLineState(n, k, state);
+        filerow++;
+        if(++k >= rowTreeSelf(n))
+        {
+            n = rowTreeNext(n);
+            k = 0;
+        }
+
+        if(filerow % KILO_HL_CHECKPOINT == 0 &&
+                filerow / KILO_HL_CHECKPOINT == E.hlcp_len)
+        {
+            /* past the last edited row, meeting the state a stale checkpoint
+                already holds means every stale checkpoint after it is right */
+            if(E.hlcp_len < E.hlcp_stale && filerow > E.hlcp_damage &&
+                    E.hlcp[E.hlcp_len] == state)
+            {
+                E.hlcp_len = E.hlcp_stale;
+                E.hlcp_damage = -1;
+                if(E.hlcp_want < E.hlcp_len)
+                    E.hlcp_want = E.hlcp_len;
+                return editorSyntaxStateAt(at);
+            }
+
+            if(E.hlcp_len == E.hlcp_cap)
+            {
+                E.hlcp_cap *= 2;
+                E.hlcp = realloc(E.hlcp, E.hlcp_cap);
+            }
+            E.hlcp[E.hlcp_len++] = state;
+            if(E.hlcp_stale < E.hlcp_len)
+                E.hlcp_stale = E.hlcp_len;
+            if(E.hlcp_want < E.hlcp_len)
+                E.hlcp_want = E.hlcp_len;
+        }
+    }
+    return state;
+}
+
+/* function that records an edit inside row 'at', 'changed' says whether the
+    comment state the row ends in may be different now */
+void editorSyntaxEdit(int at, int changed)
+{
+    int keep = at / KILO_HL_CHECKPOINT + 1;
+
+    // stale checkpoints can only be trusted past every edited row
+    if(E.hlcp_stale > E.hlcp_len && at > E.hlcp_damage)
+        E.hlcp_damage = at;
+    if(!changed || E.hlcp_len <= keep)
+        return;
+
+    // keep the cut off checkpoints so propagation can stop when it meets them
+    if(E.hlcp_stale < E.hlcp_len)
+        E.hlcp_stale = E.hlcp_len;
+    E.hlcp_len = keep;
+    if(at > E.hlcp_damage)
+        E.hlcp_damage = at;
+}
+
+// function that records a row being inserted or deleted at 'at'
+void editorSyntaxShift(int at)
+{
+    int keep = at / KILO_HL_CHECKPOINT + 1;
+
+    // the rows after 'at' moved, so no later checkpoint lines up any more
+    if(E.hlcp_len > keep)
+        E.hlcp_len = keep;
+    E.hlcp_stale = E.hlcp_len;
+    E.hlcp_damage = -1;
+}
+
+/* function that rebuilds checkpoints cut back by edits a bounded number of
+    rows at a time, returns 1 while there is work left */
+int editorSyntaxIdle()
+{
+    int goal = E.hlcp_want > E.hlcp_stale ? E.hlcp_want : E.hlcp_stale;
+    int last = E.numrows > 0 ? (E.numrows - 1) / KILO_HL_CHECKPOINT + 1 : 0;
+
+    if(goal > last)
+        goal = E.hlcp_want = last;
+    if(E.hlcp_len == 0 || E.hlcp_len >= goal)
+        return 0;
+
+    int at = (E.hlcp_len - 1) * KILO_HL_CHECKPOINT + KILO_HL_IDLE_ROWS;
+    if(at > (goal - 1) * KILO_HL_CHECKPOINT)
+        at = (goal - 1) * KILO_HL_CHECKPOINT;
+    editorSyntaxStateAt(at);
+    return E.hlcp_len < goal;
+}
+
+// function that makes sure a row's highlighting matches the state it starts in
+void editorSyntaxEnsure(erow *row, int in_comment)
+{
+    if(row->hl_in != in_comment || row->hl_gen != E.hl_gen)
+        editorUpdateSyntax(row, in_comment);
+}
+
+// function that a highlighting worker runs, taking jobs off the queue for good
+void *hlWorker(void *arg)
+{
+    struct hlPool *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while(1)
+    {
+        while(pool->todo == NULL)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+        struct hlJob *job = pool->todo;
+        pool->todo = job->next;
+        if(pool->todo == NULL)
+            pool->todo_tail = NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        struct hlState st = { job->in, 0, 1, HL_NORMAL, 0 };
+        memset(job->hl, HL_NORMAL, job->len);
+        editorHighlight(job->syntax, job->text, 0, job->len, job->hl, &st, job->len);
+        job->out = st.in_comment;
+
+        pthread_mutex_lock(&pool->lock);
+        job->next = pool->done;
+        pool->done = job;
+        // a full pipe already has the main thread on its way
+        if(write(pool->wake[1], "", 1) == -1 && errno != EAGAIN)
+            break;
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+// function that starts the highlighting workers, returns NULL if none could be
+struct hlPool *editorHighlightPool()
+{
+    struct hlPool *pool = E.hlpool;
+
+    if(pool)
+        return pool->nthreads ? pool : NULL;
+    pool = E.hlpool = calloc(1, sizeof(struct hlPool));
+    if(pipe(pool->wake) == -1)
+        return NULL;
+    fcntl(pool->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(pool->wake[1], F_SETFL, O_NONBLOCK);
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n > KILO_HL_THREADS)
+        n = KILO_HL_THREADS;
+    for(int i = 0; i < n; i++)
+        if(pthread_create(&pool->thread[pool->nthreads], NULL, hlWorker, pool) == 0)
+            pthread_detach(pool->thread[pool->nthreads++]);
+    return pool->nthreads ? pool : NULL;
+}
+
+// function that returns the workers a row is highlighted on, or NULL if it is highlighted right away
+struct hlPool *editorSyntaxAsync(erow *row)
+{
+    if(E.syntax == NULL || row->wide || row->rsize < KILO_HL_ASYNC)
+        return NULL;
+    return editorHighlightPool();
+}
+
+// function that takes a row off the rows whose edit waits for the workers
+void editorHighlightUndefer(erow *row)
+{
+    struct hlPool *pool = E.hlpool;
+
+    row->hl_defer = 0;
+    for(int i = 0; pool && i < pool->ndefer; i++)
+        if(pool->defer[i] == row)
+        {
+            pool->defer[i] = pool->defer[--pool->ndefer];
+            break;
+        }
+}
+
+/* function that lets the rows below an edited row wait for the state the
+    row ends in, which the workers find along with its highlighting */
+void editorHighlightDefer(struct hlPool *pool, erow *row)
+{
+    if(row->hl_defer)
+        return;
+    if(pool->ndefer == pool->capdefer)
+    {
+        pool->capdefer = pool->capdefer ? pool->capdefer * 2 : 16;
+        pool->defer = realloc(pool->defer, sizeof(erow *) * pool->capdefer);
+    }
+    pool->defer[pool->ndefer++] = row;
+    row->hl_defer = 1;
+}
+
+/* function that settles a deferred edit once the row knows its end state
+    again, 'told' being the state the rows below were last built from */
+void editorSyntaxSettle(erow *row, int told)
+{
+    if(!row->hl_defer)
+        return;
+    editorHighlightUndefer(row);
+    if(row->hl_open_comment != told)
+        editorSyntaxEdit(editorRowIndex(row), 1);
+}
+
+/* function that settles the deferred edits to rows off the screen without
+    waiting, nothing will ask the workers about them, so the rows below are
+    taken to have changed */
+void editorHighlightUnseen()
+{
+    struct hlPool *pool = E.hlpool;
+
+    for(int i = 0; pool && i < pool->ndefer; )
+    {
+        erow *row = pool->defer[i];
+        int at = editorRowIndex(row);
+        if(at >= E.rowoff && at < E.rowoff + E.screenrows)
+        {
+            i++;
+            continue;
+        }
+        row->hl_defer = 0;
+        pool->defer[i] = pool->defer[--pool->ndefer];
+        editorSyntaxEdit(at, 1);
+    }
+}
+
+// function that returns the job handed out for a row, or NULL
+struct hlJob *editorHighlightJob(erow *row)
+{
+    struct hlPool *pool = E.hlpool;
+
+    for(int i = 0; pool && i < pool->njobs; i++)
+        if(pool->job[i]->row == row)
+            return pool->job[i];
+    return NULL;
+}
+
+// function that takes job 'i' off the jobs handed out and frees it
+void editorHighlightDrop(struct hlPool *pool, int i)
+{
+    free(pool->job[i]->text);
+    free(pool->job[i]);
+    pool->job[i] = pool->job[--pool->njobs];
+}
+
+/* function that makes sure a row being drawn is highlighted for the state
+    it starts in. Short rows are highlighted right away, long ones are handed
+    to the workers; returns 0 if the row has to be drawn plain for now */
+int editorSyntaxRequest(erow *row, int in_comment)
+{
+    struct hlPool *pool;
+
+    if(row->hl_in == in_comment && row->hl_gen == E.hl_gen)
+        return 1;
+    if((pool = editorSyntaxAsync(row)) == NULL)
+    {
+        editorUpdateSyntax(row, in_comment);
+        return 1;
+    }
+
+    // a job already on its way for the same text only needs to be kept
+    struct hlJob *job = editorHighlightJob(row);
+    if(job && job->version == row->version && job->gen == E.hl_gen && job->in == in_comment)
+    {
+        job->frame = pool->frame;
+        return 0;
+    }
+    if(job)
+        job->row = NULL;
+
+    job = malloc(sizeof(struct hlJob));
+    job->row = row;
+    job->version = row->version;
+    job->gen = E.hl_gen;
+    job->syntax = E.syntax;
+    job->in = in_comment;
+    job->len = row->rsize;
+    job->text = malloc(2 * (size_t)row->rsize);
+    job->hl = (unsigned char *)job->text + row->rsize;
+    memcpy(job->text, row->render, row->rsize);
+    job->frame = pool->frame;
+    job->next = NULL;
+    if(pool->njobs == pool->capjobs)
+    {
+        pool->capjobs = pool->capjobs ? pool->capjobs * 2 : 64;
+        pool->job = realloc(pool->job, sizeof(struct hlJob *) * pool->capjobs);
+    }
+    pool->job[pool->njobs++] = job;
+
+    pthread_mutex_lock(&pool->lock);
+    if(pool->todo_tail)
+        pool->todo_tail->next = job;
+    else
+        pool->todo = job;
+    pool->todo_tail = job;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    return 0;
+}
+
+/* function that drops the jobs no worker took yet for rows the last frame
+    did not draw, the view moved on from them */
+void editorHighlightPrune()
+{
+    struct hlPool *pool = E.hlpool;
+
+    if(pool == NULL || pool->njobs == 0)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    struct hlJob **p = &pool->todo;
+    pool->todo_tail = NULL;
+    while(*p)
+    {
+        struct hlJob *job = *p;
+        if(job->frame != pool->frame || job->row == NULL)
+        {
+            *p = job->next;
+            job->len = -1;
+            continue;
+        }
+        pool->todo_tail = job;
+        p = &job->next;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int i = 0; i < pool->njobs; )
+    {
+        if(pool->job[i]->len == -1)
+            editorHighlightDrop(pool, i);
+        else
+            i++;
+    }
+}
+
+// function that makes the jobs for a row going away, or for every row if it is NULL, come to nothing
+void editorHighlightForget(erow *row)
+{
+    struct hlPool *pool = E.hlpool;
+
+    for(int i = 0; pool && i < pool->njobs; i++)
+        if(row == NULL || pool->job[i]->row == row)
+            pool->job[i]->row = NULL;
+    if(row == NULL && pool)
+        pool->ndefer = 0;
+    else if(row && row->hl_defer)
+        editorHighlightUndefer(row);
+}
+
+/* function that picks up what the workers finished and gives it to rows
+    still waiting for it, returns 1 if any row changed */
+int editorHighlightPoll()
+{
+    struct hlPool *pool = E.hlpool;
+    char buf[64];
+    int changed = 0;
+
+    while(read(pool->wake[0], buf, sizeof(buf)) > 0)
+        ;
+    pthread_mutex_lock(&pool->lock);
+    struct hlJob *job = pool->done;
+    pool->done = NULL;
+    pthread_mutex_unlock(&pool->lock);
+
+    while(job)
+    {
+        struct hlJob *next = job->next;
+        erow *row = job->row;
+        // results for older characters, another syntax, or a row that has its own are thrown away
+        if(row && row->version == job->version && job->gen == E.hl_gen &&
+                (row->hl_in != job->in || row->hl_gen != job->gen))
+        {
+            if(row->hl == NULL)
+                row->hl = rowAlloc(row->rsize);
+            memcpy(row->hl, job->hl, row->rsize);
+            row->hl_in = job->in;
+            row->hl_gen = job->gen;
+            int told = row->hl_open_comment;
+            row->hl_open_comment = job->out;
+            editorSyntaxSettle(row, told);
+            E.stats.highlights++;
+            changed = 1;
+        }
+        for(int i = 0; i < pool->njobs; i++)
+            if(pool->job[i] == job)
+            {
+                editorHighlightDrop(pool, i);
+                break;
+            }
+        job = next;
+    }
+    return changed;
+}
+
+//function that maps highlight values to colors
+int editorSyntaxToColor(int hl)
+{
+    // switch case for highlighting, each case is a different color
+    switch(hl)
+    {
+        case HL_NUMBER:
+            return 31;
+        case HL_KEYWORD2:
+            return 32;
+        case HL_KEYWORD1:
+            return 33;
+        case HL_MATCH:
+            return 34;
+        case HL_STRING:
+            return 35;
+        case HL_COMMENT: case HL_MLCOMMENT:
+            return 36;
+        default:
+            return 37;
+    }
+}
+
+//function that matches filename to filematch
+void editorSelectSyntaxHighlight()
+{
+    // set syntax to null and drop every highlight computed with the old one
+    E.syntax = NULL;
+    E.hl_gen++;
+    E.hlcp_len = E.hlcp_stale = E.hlcp_want = 0;
+    E.hlcp_damage = -1;
+
+    // return if file name is empty
+    if(E.filename == NULL)
+        return;
+
+    char *ext = strrchr(E.filename, '.');
+
+    // select the highlighting syntax
+    for(unsigned int j = 0; j < HLDB_ENTRIES; j++)
+    {
+        struct editorSyntax *s = &HLDB[j];
+        unsigned int i = 0;
+        while(s->filematch[i])
+        {   
+            //check for file match
+            int is_ext = (s->filematch[i][0] == '.');
+            if((is_ext && ext && !strcmp(ext, s->filematch[i])) ||
+                    (!is_ext && strstr(E.filename, s->filematch[i])))
+            {
+                // set syntax to s, rows are highlighted again when drawn
+                E.syntax = s;
+                if(s->kwtab == NULL)
+                {
+                    s->kwtab = editorCompileKeywords(s->keywords);
+                    editorCompileClasses(s);
+                }
+                return;
+            }
+            i++;
+        }
+    }
+}
+
+
+/* row operations */
+// function that returns the render offset after chars[from..to), starting at render offset 'rx'
+int editorRxAdvance(const char *chars, int from, int to, int rx)
+{
+    const char *tab;
+
+    // runs without tabs take one column a character
+    while(from < to && (tab = memchr(&chars[from], '\t', to - from)))
+    {
+        rx += tab - &chars[from];
+        rx += KILO_TAB_STOP - rx % KILO_TAB_STOP;
+        from = tab - chars + 1;
+    }
+    return rx + (to - from);
+}
+
+// function that returns how many bytes of a wide row's chars are the gap
+int editorRowGapLen(erow *row)
+{
+    return row->wide && !row->borrowed ? row->cap - row->size - 1 : 0;
+}
+
+// function that returns character 'cx' of a row, wherever the gap is
+char editorRowChar(erow *row, int cx)
+{
+    if(row->wide && cx >= row->wide->gap)
+        cx += editorRowGapLen(row);
+    return row->chars[cx];
+}
+
+// function that copies characters [from..to) of a row to 'dst', leaving the gap out
+void editorRowCopy(erow *row, int from, int to, char *dst)
+{
+    int gap = row->wide ? row->wide->gap : row->size;
+
+    if(from < gap)
+    {
+        int n = (to < gap ? to : gap) - from;
+        memcpy(dst, &row->chars[from], n);
+        dst += n;
+        from += n;
+    }
+    if(from < to)
+        memcpy(dst, &row->chars[from + editorRowGapLen(row)], to - from);
+}
+
+// function that is editorRxAdvance over characters [from..to) of a row, around the gap
+int editorRowRxAdvance(erow *row, int from, int to, int rx)
+{
+    int gap = row->wide ? row->wide->gap : row->size;
+
+    if(from < gap)
+        rx = editorRxAdvance(row->chars, from, to < gap ? to : gap, rx);
+    if(to > gap)
+        rx = editorRxAdvance(row->chars + editorRowGapLen(row), from > gap ? from : gap, to, rx);
+    return rx;
+}
+
+// function that moves the gap of a wide row it owns to before character 'at'
+void editorRowGapTo(erow *row, int at)
+{
+    struct rowWide *w = row->wide;
+    int len = editorRowGapLen(row);
+
+    if(!w || w->gap == at)
+        return;
+    if(at < w->gap)
+        memmove(&row->chars[at + len], &row->chars[at], w->gap - at);
+    else
+        memmove(&row->chars[w->gap], &row->chars[w->gap + len], at - w->gap);
+    w->gap = at;
+}
+
+// function that closes the gap of a wide row, so chars holds the line in one piece
+void editorRowFlat(erow *row)
+{
+    if(!row->wide || row->borrowed)
+        return;
+    editorRowGapTo(row, row->size);
+    row->chars[row->size] = '\0';
+}
+
+/* function that makes the render offsets of a row valid up to mark 'k',
+    extending them from the last one an edit left alone */
+void editorRowMarks(erow *row, int k)
+{
+    if(k < row->nrxmark)
+        return;
+    if(k >= row->caprxmark)
+    {
+        // room for marks to the end of the row, so typing rarely grows them
+        int want = k > row->size / KILO_RX_STEP ? k + 1 : row->size / KILO_RX_STEP + 1;
+        row->rxmark = rowResize(row->rxmark, row->caprxmark * sizeof(int), want * sizeof(int));
+        row->caprxmark = rowCapacity(want * sizeof(int)) / sizeof(int);
+    }
+    if(row->nrxmark == 0)
+        row->rxmark[row->nrxmark++] = 0;
+    for(; row->nrxmark <= k; row->nrxmark++)
+    {
+        int m = row->nrxmark;
+        row->rxmark[m] = editorRowRxAdvance(row, (m - 1) * KILO_RX_STEP,
+                m * KILO_RX_STEP, row->rxmark[m - 1]);
+    }
+}
+
+// function that drops the render offsets and highlighter states an edit from 'at' on made stale
+void editorRowEdited(erow *row, int at)
+{
+    int keep = at / KILO_RX_STEP + 1;
+
+    if(row->nrxmark > keep)
+        row->nrxmark = keep;
+    // a state depends on the characters up to and including the one it is at
+    if(row->wide)
+        while(row->wide->nmark > 0 && row->wide->mark[row->wide->nmark - 1].pos >= at)
+            row->wide->nmark--;
+}
+
+// function to change character index
+int editorRowCxToRx(erow *row, int cx)
+{
+    int k = cx / KILO_RX_STEP;
+
+    // without tabs every character is one column
+    if(!row->tabbed)
+        return cx;
+    if(k == 0)
+        return editorRowRxAdvance(row, 0, cx, 0);
+    // walk on from the mark before the character
+    editorRowMarks(row, k);
+    return editorRowRxAdvance(row, k * KILO_RX_STEP, cx, row->rxmark[k]);
+}
+
+// function to change character index
+int editorRowRxToCx(erow *row, int rx)
+{
+    //variable declaration/initialization
+    int cx, cur_rx, lo = 0, hi, last = row->size / KILO_RX_STEP;
+
+    if(!row->tabbed)
+        return rx < row->size ? rx : row->size;
+
+    // marks are only built until one passes the render offset
+    editorRowMarks(row, 0);
+    while(row->nrxmark <= last && row->rxmark[row->nrxmark - 1] <= rx)
+        editorRowMarks(row, row->nrxmark);
+
+    // find the last mark at or before the render offset
+    hi = row->nrxmark - 1;
+    while(lo < hi)
+    {
+        int mid = (lo + hi + 1) / 2;
+        if(row->rxmark[mid] <= rx)
+            lo = mid;
+        else
+            hi = mid - 1;
+    }
+
+    // convert render index back to character index
+    cur_rx = row->rxmark[lo];
+    for(cx = lo * KILO_RX_STEP; cx < row->size; cx++)
+    {
+        if(editorRowChar(row, cx) == '\t')
+            cur_rx += (KILO_TAB_STOP - 1) - (cur_rx % KILO_TAB_STOP);
+        cur_rx++;
+        if(cur_rx > rx)
+            return cx;
+    }
+    
+    return cx;
+}
+
+// function that returns how long a line of 'size' characters is once rendered
+int editorRenderLen(const char *chars, int size)
+{
+    return editorRxAdvance(chars, 0, size, 0);
+}
+
+// function that renders a line into 'render', which holds editorRenderLen() + 1 bytes
+int editorRenderTo(const char *chars, int size, char *render)
+{
+    int j, idx = 0;
+
+    // iterate through row characters
+    for(j = 0; j < size; j++)
+    {
+        if(chars[j] == '\t')
+        {
+            render[idx++] = ' ';
+            while(idx % KILO_TAB_STOP != 0)
+                render[idx++] = ' ';
+        }
+        else
+        {
+            render[idx++] = chars[j];
+        }
+    }
+    render[idx] = '\0';
+    return idx;
+}
+
+// function that returns the size of the block starting at hl, render included when it is a copy
+size_t editorRowBlock(const erow *row)
+{
+    return row->tabbed ? 2 * (size_t)row->rsize + 1 : (size_t)row->rsize;
+}
+
+// function that counts the tabs in s[0..len)
+int editorCountTabs(const char *s, int len)
+{
+    const char *end = s + len;
+    int tabs = 0;
+
+    while((s = memchr(s, '\t', end - s)))
+    {
+        tabs++;
+        s++;
+    }
+    return tabs;
+}
+
+// function that counts the tabs in characters [from..to) of a row
+int editorRowTabs(erow *row, int from, int to)
+{
+    int gap = row->wide ? row->wide->gap : row->size, tabs = 0;
+
+    while(from < to)
+    {
+        // the characters before the gap and those after it are counted apart
+        int stop = from < gap ? (to < gap ? to : gap) : to;
+        tabs += editorCountTabs(&row->chars[from < gap ? from : from + editorRowGapLen(row)],
+                stop - from);
+        from = stop;
+    }
+    return tabs;
+}
+
+// function that turns a row that grew past KILO_WIDE_ROW into a wide one
+void editorRowWiden(erow *row)
+{
+    struct rowWide *w = rowAlloc(sizeof(struct rowWide));
+
+    memset(w, 0, sizeof(*w));
+    // render is either the characters or part of the hl block
+    rowFree(row->hl, editorRowBlock(row));
+    row->hl = NULL;
+    row->render = NULL;
+    w->gap = row->size;
+    w->ntabs = -1;
+    row->wide = w;
+}
+
+// function that turns a wide row that shrank back into one with a render and hl
+void editorRowNarrow(erow *row)
+{
+    struct rowWide *w = row->wide;
+
+    editorRowFlat(row);
+    rowFree(w->mark, w->capmark * sizeof(struct hlMark));
+    rowFree(w, sizeof(struct rowWide));
+    row->wide = NULL;
+    row->tabbed = 0;
+    row->rsize = 0;
+}
+
+// function that returns the comment state a row ends in when it starts in 'in_comment'
+int editorRowScan(erow *row, int in_comment)
+{
+    if(E.syntax == NULL)
+        return 0;
+    editorRowFlat(row);
+    return editorSyntaxScan(row->chars, row->size, in_comment);
+}
+
+// function that tells whether a character can be part of a comment delimiter, quote or escape
+int editorSyntaxSpecial(int c)
+{
+    struct editorSyntax *syn = E.syntax;
+
+    if(c == 0)
+        return 0;
+    return c == '\\' || c == '"' || c == '\'' ||
+            (syn->singleline_comment_start && strchr(syn->singleline_comment_start, c)) ||
+            (syn->multiline_comment_start && strchr(syn->multiline_comment_start, c)) ||
+            (syn->multiline_comment_end && strchr(syn->multiline_comment_end, c));
+}
+
+/* function that tells whether putting 'c' between 'before' and 'after', or
+    taking it out from between them, leaves every comment and string of the
+    line where it was: 'c' must not be special, and the two characters it
+    parts or joins must not both be */
+int editorSyntaxQuiet(int before, int c, int after)
+{
+    if(E.syntax == NULL)
+        return 1;
+    return !editorSyntaxSpecial(c) &&
+            (!editorSyntaxSpecial(before) || !editorSyntaxSpecial(after));
+}
+
+/* function that builds the render array of a row, its highlighting is left
+    stale and recomputed when the row is drawn. A row without tabs renders
+    as its characters, so render only points at them and is not terminated. */
+void editorRenderRow(erow *row)
+{
+    row->version = ++E.row_version;
+
+    // rows only turn back from wide well below the limit, so edits there do not flip them
+    if(!row->wide && row->size > KILO_WIDE_ROW)
+        editorRowWiden(row);
+    else if(row->wide && row->size < KILO_WIDE_ROW / 2)
+        editorRowNarrow(row);
+
+    // a wide row is rendered a window at a time when it is drawn
+    if(row->wide)
+    {
+        if(row->wide->ntabs < 0)
+            row->wide->ntabs = editorRowTabs(row, 0, row->size);
+        row->tabbed = row->wide->ntabs > 0;
+        row->rsize = row->size;
+        row->hl_in = -1;
+        return;
+    }
+
+    int tabbed = memchr(row->chars, '\t', row->size) != NULL;
+    int len = tabbed ? editorRenderLen(row->chars, row->size) : row->size;
+    size_t old = editorRowBlock(row);
+
+    // the block only moves when it outgrows its size class
+    if(row->hl || tabbed)
+        row->hl = rowResize(row->hl, old, tabbed ? 2 * (size_t)len + 1 : (size_t)len);
+    row->tabbed = tabbed;
+    row->rsize = len;
+    if(tabbed)
+    {
+        row->render = (char *)row->hl + len;
+        editorRenderTo(row->chars, row->size, row->render);
+    }
+    else
+    {
+        row->render = row->chars;
+    }
+    // mark the highlighting as stale
+    row->hl_in = -1;
+}
+
+//function that updates render array when current row changes
+void editorUpdateRow(erow *row)
+{
+    int in = row->hl_in, out = row->hl_open_comment;
+    int known = (in != -1 && row->hl_gen == E.hl_gen);
+
+    int quiet = row->wide && row->wide->quiet;
+
+    editorRenderRow(row);
+    /* a wide row is never highlighted as a whole, it keeps the state it ends
+        in up to date itself, without a scan if the edit was quiet */
+    if(row->wide && known)
+    {
+        int now = quiet ? out : editorRowScan(row, in);
+        row->wide->quiet = 0;
+        row->hl_in = in;
+        row->hl_open_comment = now;
+        editorSyntaxEdit(editorRowIndex(row), now != out);
+        return;
+    }
+    /* the rows below only need work if the comment state leaving this one
+        moved. A long row finds out on the workers: the rows below it are
+        drawn plain until its highlighting comes back, and only then are the
+        checkpoints after it cut, if the state moved */
+    struct hlPool *pool;
+    if((known || row->hl_defer) && (pool = editorSyntaxAsync(row)))
+    {
+        editorHighlightDefer(pool, row);
+        editorSyntaxEdit(editorRowIndex(row), 0);
+        return;
+    }
+    if(row->hl_defer)
+        editorHighlightUndefer(row);
+    editorSyntaxEdit(editorRowIndex(row),
+            !known || editorRowScan(row, in) != out);
+}
+
+// function that saves a highlighter state inside a wide row
+void editorRowAddMark(struct rowWide *w, struct hlMark m)
+{
+    if(w->nmark == w->capmark)
+    {
+        int want = w->capmark ? w->capmark * 2 : 16;
+        w->mark = rowResize(w->mark, w->capmark * sizeof(struct hlMark),
+                want * sizeof(struct hlMark));
+        w->capmark = rowCapacity(want * sizeof(struct hlMark)) / sizeof(struct hlMark);
+    }
+    w->mark[w->nmark++] = m;
+}
+
+/* function that renders and highlights the part of a wide row that shows
+    from render offset 'rx' on, at most 'cols' cells, points 'render' and 'hl'
+    at them and returns how many there are. Highlighting starts from the last
+    state saved at or before the window, and saves one every KILO_WIDE_SPAN
+    characters on the way there, so scrolling along the row only highlights
+    it once. */
+int editorRowWindow(erow *row, int rx, int cols, char **render, unsigned char **hl)
+{
+    static char *text, *cell;
+    static unsigned char *color, *cellhl;
+    static int captext, capcell;
+    struct rowWide *w = row->wide;
+    struct hlMark at = { 0, { row->hl_in, 0, 1, HL_NORMAL, 0 } };
+    int cx0 = editorRowRxToCx(row, rx), cx1, crx, r, n = 0, k;
+
+    if(cols <= 0 || cx0 >= row->size)
+        return 0;
+
+    // the characters that reach into the window
+    crx = editorRowCxToRx(row, cx0);
+    for(cx1 = cx0, r = crx; cx1 < row->size && r < rx + cols; cx1++)
+        r = editorRowRxAdvance(row, cx1, cx1 + 1, r);
+
+    if(cols > capcell)
+    {
+        capcell = cols;
+        cell = realloc(cell, capcell);
+        cellhl = realloc(cellhl, capcell);
+    }
+    if(cx1 - cx0 + KILO_WIDE_SPAN + KILO_WIDE_MARGIN > captext)
+    {
+        captext = cx1 - cx0 + KILO_WIDE_SPAN + KILO_WIDE_MARGIN;
+        text = realloc(text, captext);
+        color = realloc(color, captext);
+    }
+
+    if(E.syntax)
+    {
+        if(w->mark_in != row->hl_in || w->mark_gen != E.hl_gen)
+        {
+            w->nmark = 0;
+            w->mark_in = row->hl_in;
+            w->mark_gen = E.hl_gen;
+        }
+        // save states up to within a span of the window
+        if(w->nmark)
+            at = w->mark[w->nmark - 1];
+        while(!at.st.rest && at.pos + KILO_WIDE_SPAN <= cx0)
+        {
+            int len = row->size - at.pos;
+            if(len > KILO_WIDE_SPAN + KILO_WIDE_MARGIN)
+                len = KILO_WIDE_SPAN + KILO_WIDE_MARGIN;
+            editorRowCopy(row, at.pos, at.pos + len, text);
+            memset(color, HL_NORMAL, len);
+            at.pos += editorHighlight(E.syntax, text, 0, len, color, &at.st, KILO_WIDE_SPAN);
+            editorRowAddMark(w, at);
+        }
+
+        // the last one at or before the window, after a single line comment all are the same
+        for(k = w->nmark - 1; k >= 0 && w->mark[k].pos > cx0; k--)
+            ;
+        at = k >= 0 ? w->mark[k] : (struct hlMark){ 0, { row->hl_in, 0, 1, HL_NORMAL, 0 } };
+        if(at.st.rest)
+            at.pos = cx0;
+
+        // keywords and delimiters ending past the window still need reading
+        int end = cx1 + KILO_WIDE_MARGIN < row->size ? cx1 + KILO_WIDE_MARGIN : row->size;
+        editorRowCopy(row, at.pos, end, text);
+        memset(color, HL_NORMAL, end - at.pos);
+        editorHighlight(E.syntax, text, 0, end - at.pos, color, &at.st, cx1 - at.pos);
+    }
+    else
+    {
+        at.pos = cx0;
+        editorRowCopy(row, cx0, cx1, text);
+        memset(color, HL_NORMAL, cx1 - cx0);
+    }
+
+    // expand tabs and keep the cells inside the window
+    for(k = cx0, r = crx; k < cx1; k++)
+    {
+        char c = text[k - at.pos];
+        int next = editorRxAdvance(&c, 0, 1, r);
+        for(; r < next; r++)
+            if(r >= rx && r < rx + cols)
+            {
+                cell[n] = c == '\t' ? ' ' : c;
+                cellhl[n++] = color[k - at.pos];
+            }
+    }
+
+    // the match a search is showing in the row
+    for(k = 0; k < n; k++)
+        if(rx + k >= w->match_rx && rx + k < w->match_rx + w->match_len)
+            cellhl[k] = HL_MATCH;
+
+    *render = cell;
+    *hl = cellhl;
+    return n;
+}
+
+/* function that makes a detached node for a new row holding s[0..len)
+    followed by t[0..tlen) */
+struct rownode *editorNewRow(const char *s, size_t len, const char *t, size_t tlen)
+{
+    // assign new values to struct variables
+    struct rownode *n = rowTreeNode(0, 0);
+    erow *row = &n->row;
+    row->size = len + tlen;
+    row->chars = rowAlloc(len + tlen + 1);
+    row->cap = rowCapacity(len + tlen + 1);
+    memcpy(row->chars, s, len);
+    if(tlen)
+        memcpy(row->chars + len, t, tlen);
+    row->chars[len + tlen] = '\0';
+    row->rsize = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    row->tabbed = 0;
+    row->rxmark = NULL;
+    row->nrxmark = row->caprxmark = 0;
+    row->wide = NULL;
+    row->hl_open_comment = 0;
+    row->hl_gen = 0;
+    row->hl_defer = 0;
+    row->borrowed = 0;
+    row->save_gen = 0;
+    //call function and pass the new row
+    editorRenderRow(row);
+    return n;
+}
+
+/* function that makes a detached node for a row read from disk, its
+    characters go in the load arena until it is first edited */
+struct rownode *editorLoadedRow(const char *s, size_t len)
+{
+    struct rownode *n = rowTreeNode(0, 0);
+    erow *row = &n->row;
+    row->size = len;
+    row->chars = rowArenaAlloc(len + 1);
+    row->cap = 0;
+    memcpy(row->chars, s, len);
+    row->chars[len] = '\0';
+    row->rsize = 0;
+    row->render = NULL;
+    row->hl = NULL;
+    row->tabbed = 0;
+    row->rxmark = NULL;
+    row->nrxmark = row->caprxmark = 0;
+    row->wide = NULL;
+    row->hl_open_comment = 0;
+    row->hl_gen = 0;
+    row->hl_defer = 0;
+    row->borrowed = 1;
+    row->save_gen = 0;
+    editorRenderRow(row);
+    return n;
+}
+
+// function that makes room for 'size' bytes of characters in a row it owns
+void editorRowReserve(erow *row, int size)
+{
+    if(size <= row->cap)
+        return;
+    // a wide row grows with its gap closed, which leaves the new room as the gap
+    if(row->wide)
+        editorRowFlat(row);
+    // long rows grow by half again, shorter ones move up a size class
+    size_t want = size > KILO_SLAB_MAX ? size + size / 2 : size;
+    row->chars = rowResize(row->chars, row->cap, want);
+    row->cap = rowCapacity(want);
+}
+
+/* function that links a tree of 'count' new rows in before row 'at', which
+    must already be loaded */
+void editorInsertRows(int at, struct rownode *rows, int count)
+{
+    struct rownode *l, *r;
+
+    // link the nodes in between the first 'at' rows and the rest
+    rowTreeSplit(E.rows, at, &l, &r);
+    E.rows = rowTreeMerge(rowTreeMerge(l, rows), r);
+    //increment row count and modified buffer
+    E.numrows += count;
+    E.dirty++;
+    editorSyntaxShift(at);
+}
+
+// function to insert row
+void editorInsertRow(int at, char *s, size_t len)
+{
+    if(at < 0 || at > E.numrows)
+        return;
+    // load the row at the insertion point so it sits on a node boundary
+    if(at < E.numrows)
+        editorRowAt(at);
+
+    editorInsertRows(at, editorNewRow(s, len, NULL, 0), 1);
+}
+
+// function to free up space
+void editorFreeRow(erow *row)
+{
+    editorHighlightForget(row);
+    // render is either the characters or part of the hl block
+    rowFree(row->hl, editorRowBlock(row));
+    rowFree(row->rxmark, row->caprxmark * sizeof(int));
+    if(row->wide)
+    {
+        rowFree(row->wide->mark, row->wide->capmark * sizeof(struct hlMark));
+        rowFree(row->wide, sizeof(struct rowWide));
+    }
+    // a save still reading the characters frees them when it is done
+    if(E.save && row->save_gen == E.save->gen)
+        saveKeep(row->chars, row->cap);
+    else if(!row->borrowed)
+        rowFree(row->chars, row->cap);
+}
+
+/* function that gives a row its own copy of a line it borrows from the
+    mapping or the load arena before an edit, or of characters a running save
+    still reads */
+void editorRowDetach(erow *row)
+{
+    int shared = E.save && row->save_gen == E.save->gen;
+
+    if(!row->borrowed && !shared)
+        return;
+
+    // a wide row is edited in place, so it starts out with a gap to take the edits
+    size_t want = row->size + 1 + (row->wide ? row->size / 2 : 0);
+    char *chars = rowAlloc(want);
+    editorRowCopy(row, 0, row->size, chars);
+    chars[row->size] = '\0';
+    if(shared)
+        saveKeep(row->chars, row->cap);
+    row->chars = chars;
+    row->cap = rowCapacity(want);
+    if(row->wide)
+        row->wide->gap = row->size;
+    row->borrowed = 0;
+    row->save_gen = 0;
+}
+
+//function to remove row
+void editorDelRow(int at)
+{
+    if(at < 0 || at >= E.numrows)
+        return;
+
+    // unlink the node and rejoin the rows around it
+    struct rownode *l, *m, *r;
+    editorRowAt(at);
+    editorSyntaxShift(at);
+    rowTreeSplit(E.rows, at, &l, &r);
+    rowTreeSplit(r, 1, &m, &r);
+    E.rows = rowTreeMerge(l, r);
+
+    // free row space
+    editorFreeRow(&m->row);
+    rowFree(m, sizeof(struct rownode));
+    // decrement row count and increment modified buffer
+    E.numrows--;
+    E.dirty++;
+}
+
+//function to insert characters at cursor position
+void editorRowInsertChar(erow *row, int at, int c)
+{
+    // set at equal to row size
+    if(at < 0 || at > row->size)
+        at = row->size;
+    editorRowDetach(row);
+    // make room for the character, rows keep headroom so this rarely moves them
+    editorRowReserve(row, row->size + 2);
+    editorRowEdited(row, at);
+    if(row->wide)
+    {
+        // a wide row takes the character into its gap, which moves only as far as the cursor did
+        struct rowWide *w = row->wide;
+        w->quiet = editorSyntaxQuiet(at > 0 ? editorRowChar(row, at - 1) : 0, c,
+                at < row->size ? editorRowChar(row, at) : 0);
+        editorRowGapTo(row, at);
+        row->chars[w->gap++] = c;
+        if(c == '\t' && w->ntabs >= 0)
+            w->ntabs++;
+    }
+    else
+    {
+        memmove(&row->chars[at + 1], &row->chars[at], row->size - at + 1);
+        // set char[at] to character 'c'
+        row->chars[at] = c;
+    }
+    // increase row size
+    row->size++;
+    // call function to update row
+    editorUpdateRow(row);
+    // modified buffer
+    E.dirty++;
+}
+
+// function to append a string to current row
+void editorRowAppendString(erow *row, char *s, size_t len)
+{
+    editorRowDetach(row);
+    editorRowReserve(row, row->size + len + 1);
+    editorRowEdited(row, row->size);
+    if(row->wide)
+    {
+        editorRowGapTo(row, row->size);
+        row->wide->gap += len;
+        if(row->wide->ntabs >= 0)
+            row->wide->ntabs += editorCountTabs(s, len);
+    }
+    // append string 's' to end of current row
+    memcpy(&row->chars[row->size], s, len);
+    // update row size
+    row->size += len;
+    // set null term for end of row
+    row->chars[row->size] = '\0';
+    //update row
+    editorUpdateRow(row);
+    //modified buffer
+    E.dirty++;
+}
+
+// function to delete character in row
+void editorRowDelChar(erow *row, int at)
+{
+    if(at < 0 || at >= row->size)
+        return;
+    editorRowDetach(row);
+    editorRowEdited(row, at);
+    if(row->wide)
+    {
+        // the character of a wide row joins its gap
+        struct rowWide *w = row->wide;
+        int c = editorRowChar(row, at);
+        w->quiet = editorSyntaxQuiet(at > 0 ? editorRowChar(row, at - 1) : 0, c,
+                at + 1 < row->size ? editorRowChar(row, at + 1) : 0);
+        if(c == '\t' && w->ntabs >= 0)
+            w->ntabs--;
+        editorRowGapTo(row, at + 1);
+        w->gap--;
+    }
+    else
+        // delete character at [at +1] and decrement row size
+        memmove(&row->chars[at], &row->chars[at + 1], row->size - at);
+    row->size--;
+    //update row
+    editorUpdateRow(row);
+    //modified buffer
+    E.dirty++;
+}
+
+
+/* editor operations */
 //function to insert character at cursor
 void editorInsertChar(int c)
 {
-    //add empty row
-    if(E.cy == E.numrows)
-        editorInsertRow(E.numrows, "", 0);
+    //add empty row
+    if(E.cy == E.numrows)
+        editorInsertRow(E.numrows, "", 0);
+
+    // insert character in row at cursor position
+    editorRowInsertChar(editorRowAt(E.cy), E.cx, c);
+    //update cursor x position
+    E.cx++;
+}
+
+//function to insert new line
+void editorInsertNewline()
+{
+    // add empty row
+    if(E.cx == 0)
+    {
+        editorInsertRow(E.cy, "", 0);
+    }
+    else
+    {
+        erow *row = editorRowAt(E.cy);
+        if(row->wide)
+            editorRowFlat(row);
+        // insert new line in the middle of current row
+        editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
+        editorRowDetach(row);
+        editorRowEdited(row, E.cx);
+        // set row size
+        row->size = E.cx;
+        row->chars[row->size] = '\0';
+        if(row->wide)
+        {
+            row->wide->gap = row->size;
+            row->wide->ntabs = -1;
+        }
+        editorUpdateRow(row);
+    }
+    // update cursor positions
+    E.cy++;
+    E.cx = 0;
+}
+
+// function that returns the length of the line ending at s[0..len), 0 if there is none
+int editorLineEnd(const char *s, int len)
+{
+    if(len > 0 && s[0] == '\n')
+        return 1;
+    if(len > 0 && s[0] == '\r')
+        return len > 1 && s[1] == '\n' ? 2 : 1;
+    return 0;
+}
+
+/* function that inserts text at the cursor in one edit: the cursor row is
+    split once, every line after the first becomes a new row, and the new rows
+    join the tree together, so the whole paste costs one rehighlight */
+void editorInsertText(const char *s, int len)
+{
+    const char *end = s + len, *p = s;
+
+    if(len == 0)
+        return;
+    if(E.cy == E.numrows)
+        editorInsertRow(E.numrows, "", 0);
+
+    // the first line goes into the cursor row
+    while(p < end && *p != '\n' && *p != '\r')
+        p++;
+    erow *row = editorRowAt(E.cy);
+    if(p == end)
+    {
+        editorRowDetach(row);
+        editorRowReserve(row, row->size + len + 1);
+        editorRowEdited(row, E.cx);
+        if(row->wide)
+        {
+            // a wide row takes the text into its gap
+            editorRowGapTo(row, E.cx);
+            row->wide->gap += len;
+            if(row->wide->ntabs >= 0)
+                row->wide->ntabs += editorCountTabs(s, len);
+        }
+        else
+            memmove(&row->chars[E.cx + len], &row->chars[E.cx], row->size - E.cx + 1);
+        memcpy(&row->chars[E.cx], s, len);
+        row->size += len;
+        editorUpdateRow(row);
+        E.dirty++;
+        E.cx += len;
+        return;
+    }
+
+    // the rest of the cursor row moves to the end of the last line
+    int taillen = row->size - E.cx;
+    char *tail = malloc(taillen + 1);
+    if(row->wide)
+        editorRowFlat(row);
+    memcpy(tail, &row->chars[E.cx], taillen);
+    row->size = E.cx;
+    if(row->wide)
+    {
+        row->wide->gap = row->size;
+        row->wide->ntabs = -1;
+    }
+    editorRowAppendString(row, (char *)s, p - s);
+
+    // the other lines become rows of a tree of their own
+    struct rownode *rows = NULL;
+    int count = 0;
+    p += editorLineEnd(p, end - p);
+    while(1)
+    {
+        const char *q = p;
+        while(q < end && *q != '\n' && *q != '\r')
+            q++;
+        if(q == end)
+        {
+            rows = rowTreeMerge(rows, editorNewRow(p, q - p, tail, taillen));
+            E.cx = q - p;
+            count++;
+            break;
+        }
+        rows = rowTreeMerge(rows, editorNewRow(p, q - p, NULL, 0));
+        count++;
+        p = q + editorLineEnd(q, end - q);
+    }
+    free(tail);
+
+    if(E.cy + 1 < E.numrows)
+        editorRowAt(E.cy + 1);
+    editorInsertRows(E.cy + 1, rows, count);
+    E.cy += count;
+}
+
+//function to delete character
+void editorDelChar()
+{
+    if(E.cy == E.numrows)
+        return;
+    if(E.cx == 0 && E.cy == 0)
+        return;
+
+    erow *row = editorRowAt(E.cy);
+
+    // checking cursor position
+    if(E.cx > 0)
+    {
+        // delete character left of cursor
+        editorRowDelChar(row, E.cx - 1);
+        //reposition cursor
+        E.cx--;
+    }
+    else
+    {
+        // get cursor to move back to previous row
+        erow *prev = editorRowPrev(row);
+        E.cx = prev->size;
+        if(row->wide)
+            editorRowFlat(row);
+        //append string to previous row
+        editorRowAppendString(prev, row->chars, row->size);
+        //delete row
+        editorDelRow(E.cy);
+        E.cy--;
+    }
+}
+
+
+/* file I/O */
+// function that adds a piece of the buffer to a save snapshot
+void saveAdd(struct saveJob *job, const char *s, size_t len)
+{
+    if(len == 0)
+        return;
+    if(job->n == job->cap)
+    {
+        job->cap = job->cap ? job->cap * 2 : 1024;
+        job->iov = realloc(job->iov, sizeof(struct iovec) * job->cap);
+    }
+    job->iov[job->n].iov_base = (void *)s;
+    job->iov[job->n++].iov_len = len;
+    job->size += len;
+}
+
+/* function that takes a snapshot of the buffer without copying it: loaded
+    rows are marked so edits copy them first, and a run of unloaded lines is
+    one piece of the mapping when it has no line endings to strip */
+void saveSnapshot(struct saveJob *job)
+{
+    struct rownode *n;
+    const char *s;
+    int j, len;
+
+    for(n = rowTreeFirst(); n; n = rowTreeNext(n))
+    {
+        if(!n->span)
+        {
+            if(!n->row.borrowed)
+                n->row.save_gen = job->gen;
+            // the writer takes a wide row in one piece, an edit detaches it before opening a gap
+            editorRowFlat(&n->row);
+            saveAdd(job, n->row.chars, n->row.size);
+            saveAdd(job, "\n", 1);
+            continue;
+        }
+
+        size_t from = E.lineoff[n->first], to = E.lineoff[n->first + n->span];
+        // the last line of the file may have no newline, one is added as before
+        int tail = to > E.maplen;
+        if(tail)
+            to = E.maplen;
+        if(!memchr(E.map + from, '\r', to - from))
+        {
+            saveAdd(job, E.map + from, to - from);
+            if(tail)
+                saveAdd(job, "\n", 1);
+            continue;
+        }
+        for(j = 0; j < n->span; j++)
+        {
+            s = editorMapLine(n->first + j, &len);
+            saveAdd(job, s, len);
+            saveAdd(job, "\n", 1);
+        }
+    }
+}
+
+// function that hands row characters the snapshot still reads to the save to free
+void saveKeep(char *chars, int cap)
+{
+    struct saveJob *job = E.save;
+
+    if(job->ndead == job->capdead)
+    {
+        job->capdead = job->capdead ? job->capdead * 2 : 64;
+        job->dead = realloc(job->dead, sizeof(struct iovec) * job->capdead);
+    }
+    job->dead[job->ndead].iov_base = chars;
+    job->dead[job->ndead++].iov_len = cap;
+}
+
+// function that writes the snapshot in writev batches, returns -1 on error
+int saveWrite(struct saveJob *job)
+{
+    struct iovec *iov = job->iov, *end = job->iov + job->n;
+    int pct = 0;
+
+    while(iov < end)
+    {
+        int n = end - iov > KILO_SAVE_IOV ? KILO_SAVE_IOV : end - iov;
+        ssize_t done = writev(job->fd, iov, n);
+        if(done == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            return -1;
+        }
+        long long written = __atomic_add_fetch(&job->written, done, __ATOMIC_RELAXED);
+
+        // a short write leaves the rest of the batch, maybe half a piece
+        while(iov < end && (size_t)done >= iov->iov_len)
+            done -= (iov++)->iov_len;
+        if(iov < end)
+        {
+            iov->iov_base = (char *)iov->iov_base + done;
+            iov->iov_len -= done;
+        }
+
+        // the UI hears about every percent written
+        if(written * 100 / job->size != pct)
+        {
+            pct = written * 100 / job->size;
+            __atomic_add_fetch(&job->ticks, 1, __ATOMIC_RELEASE);
+            write(job->wake[1], "", 1);
+        }
+    }
+    return 0;
+}
+
+// function that flushes the directory holding 'path' to disk, so a rename in it lasts
+void saveSyncDir(const char *path)
+{
+    const char *slash = strrchr(path, '/');
+    char *dir = strndup(path, slash == path ? 1 : slash ? slash - path : 0);
+    int fd = open(slash ? dir : ".", O_RDONLY);
+
+    if(fd != -1)
+    {
+        fsync(fd);
+        close(fd);
+    }
+    free(dir);
+}
+
+/* function that a writer thread runs: it writes the snapshot to the temporary
+    file and renames it over the target, so the old contents survive until
+    the new ones are complete */
+void *saveWorker(void *arg)
+{
+    struct saveJob *job = arg;
+    int err = 0;
+
+    if(saveWrite(job) == -1 || (KILO_SAVE_SYNC && fdatasync(job->fd) == -1))
+        err = errno;
+    if(close(job->fd) == -1 && !err)
+        err = errno;
+    if(!err && rename(job->tmpname, job->path) == -1)
+        err = errno;
+    if(err)
+        unlink(job->tmpname);
+    else if(KILO_SAVE_SYNC)
+        saveSyncDir(job->path);
+
+    job->err = err;
+    __atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&job->ticks, 1, __ATOMIC_RELEASE);
+    write(job->wake[1], "", 1);
+    return NULL;
+}
+
+/* function that snapshots the buffer and starts writing it to 'filename' on
+    a thread of its own. Returns -1 with errno set if it could not start */
+int editorSaveStart(const char *filename)
+{
+    struct saveJob *job = calloc(1, sizeof(struct saveJob));
+    struct stat st;
+
+    clock_gettime(CLOCK_MONOTONIC, &job->t0);
+    // write next to the file a symlink points at, not over the link
+    job->path = realpath(filename, NULL);
+    if(job->path == NULL)
+        job->path = strdup(filename);
+    job->tmpname = malloc(strlen(job->path) + 8);
+    sprintf(job->tmpname, "%s.XXXXXX", job->path);
+
+    job->fd = mkstemp(job->tmpname);
+    if(job->fd == -1 || pipe(job->wake) == -1)
+    {
+        int err = errno;
+        if(job->fd != -1)
+        {
+            close(job->fd);
+            unlink(job->tmpname);
+        }
+        free(job->tmpname);
+        free(job->path);
+        free(job);
+        errno = err;
+        return -1;
+    }
+    fcntl(job->wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(job->wake[1], F_SETFL, O_NONBLOCK);
+
+    // the new file takes the old one's permissions, or the usual ones for a new file
+    if(stat(job->path, &st) == 0)
+    {
+        fchmod(job->fd, st.st_mode & 07777);
+    }
+    else
+    {
+        mode_t mask = umask(0);
+        umask(mask);
+        fchmod(job->fd, 0666 & ~mask);
+    }
+
+    job->gen = ++E.save_gen;
+    job->dirty = E.dirty;
+    saveSnapshot(job);
+    E.save = job;
+
+    // without a thread the save runs here, like it used to
+    if(pthread_create(&job->thread, NULL, saveWorker, job) != 0)
+    {
+        saveWorker(job);
+        job->thread = pthread_self();
+    }
+    return 0;
+}
+
+/* function that reaps a finished save: it reports the result, lets go of the
+    snapshot and settles E.dirty, which keeps counting edits made meanwhile */
+void editorSaveFinish()
+{
+    struct saveJob *job = E.save;
+    struct timespec t1;
+    int again = job->again, i;
+
+    if(!pthread_equal(job->thread, pthread_self()))
+        pthread_join(job->thread, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    if(job->err)
+    {
+        //print error to user if error returns
+        editorSetStatusMessage("Cannot save! I/O error: %s", strerror(job->err));
+    }
+    else
+    {
+        //inform user of how much bytes were saved to disk and how fast
+        double secs = (t1.tv_sec - job->t0.tv_sec) + (t1.tv_nsec - job->t0.tv_nsec) / 1e9;
+        E.dirty = E.dirty > job->dirty ? E.dirty - job->dirty : 0;
+        editorSetStatusMessage("%lld bytes written to disk in %.0f ms (%.1f MB/s)",
+                job->size, secs * 1e3, secs > 0 ? job->size / secs / 1e6 : 0.0);
+        // what is on disk now is the buffer, under a name it may not have had
+        editorWatchFile();
+    }
+
+    E.save = NULL;
+    for(i = 0; i < job->ndead; i++)
+        rowFree(job->dead[i].iov_base, job->dead[i].iov_len);
+    free(job->dead);
+    free(job->iov);
+    close(job->wake[0]);
+    close(job->wake[1]);
+    free(job->tmpname);
+    free(job->path);
+    free(job);
+
+    // a Ctrl-S during the save writes what was typed since
+    if(again && editorSaveStart(E.filename) == -1)
+        editorSetStatusMessage("Cannot save! I/O error: %s", strerror(errno));
+}
+
+// function that takes in a save's progress, reaping it once it is done, returns 1 if it moved on
+int editorSavePoll()
+{
+    struct saveJob *job = E.save;
+    char drain[64];
+
+    while(read(job->wake[0], drain, sizeof(drain)) > 0)
+        ;
+    int ticks = __atomic_load_n(&job->ticks, __ATOMIC_ACQUIRE);
+    if(ticks == job->seen)
+        return 0;
+    job->seen = ticks;
+    if(__atomic_load_n(&job->done, __ATOMIC_ACQUIRE))
+        editorSaveFinish();
+    return 1;
+}
+
+/* function that finds the newlines in s[from..to), storing the offset just
+    past each one in 'off' unless it is NULL, and returns how many there are */
+size_t editorSplitLines(const char *s, size_t from, size_t to, size_t *off)
+{
+    size_t i = from, lines = 0;
+
+#if defined(__AVX2__)
+    __m256i wnl = _mm256_set1_epi8('\n');
+
+    // compare 32 bytes at a time, each set bit of the mask is a newline
+    while(i + 32 <= to)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        unsigned int bits = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, wnl));
+        if(off == NULL)
+            lines += __builtin_popcount(bits);
+        else
+            for(; bits; bits &= bits - 1, lines++)
+                off[lines] = i + __builtin_ctz(bits) + 1;
+        i += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i vnl = _mm_set1_epi8('\n');
+
+    // compare 16 bytes at a time, each set bit of the mask is a newline
+    while(i + 16 <= to)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        unsigned int bits = _mm_movemask_epi8(_mm_cmpeq_epi8(v, vnl));
+        if(off == NULL)
+            lines += __builtin_popcount(bits);
+        else
+            for(; bits; bits &= bits - 1, lines++)
+                off[lines] = i + __builtin_ctz(bits) + 1;
+        i += 16;
+    }
+#endif
+    // scalar tail, and the whole scan on other machines
+    const char *p = s + i, *end = s + to;
+    while(p < end && (p = memchr(p, '\n', end - p)) != NULL)
+    {
+        p++;
+        if(off)
+            off[lines] = p - s;
+        lines++;
+    }
+    return lines;
+}
+
+// function that a loader thread runs on its slice of the mapping
+void *loadWorker(void *arg)
+{
+    struct loadSlice *sl = arg;
+
+    sl->lines = editorSplitLines(sl->map, sl->from, sl->to, sl->off);
+    return NULL;
+}
+
+/* function that runs the 'n' slices on threads of their own, the first on
+    the calling thread, and waits for all of them */
+void editorLoadRun(struct loadSlice *slice, int n)
+{
+    pthread_t thread[KILO_LOAD_THREADS];
+    int started[KILO_LOAD_THREADS];
+
+    for(int i = 1; i < n; i++)
+        started[i] = pthread_create(&thread[i], NULL, loadWorker, &slice[i]) == 0;
+    loadWorker(&slice[0]);
+    for(int i = 1; i < n; i++)
+    {
+        // a thread that could not be started leaves its slice to this one
+        if(started[i])
+            pthread_join(thread[i], NULL);
+        else
+            loadWorker(&slice[i]);
+    }
+}
+
+/* function that catches reading the mapping past the end of a file another
+    program cut short: the pages from there to the end of the mapping are
+    replaced with zeros and the read goes on, the file watch then opens the
+    file again. A fault anywhere else is left to kill the editor. */
+void editorMapFault(int sig, siginfo_t *si, void *ctx)
+{
+    const char *addr = si->si_addr;
+    size_t page = E.mappage;
+
+    (void)sig;
+    (void)ctx;
+    if(E.map == NULL || addr < E.map || addr >= E.map + E.maplen)
+    {
+        signal(SIGBUS, SIG_DFL);
+        return;
+    }
+    size_t from = (addr - E.map) / page * page;
+    mmap((void *)(E.map + from), E.maplen - from, PROT_READ,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+}
+
+/* This function maps a large file and only records where each line starts,
+    rows are created from the mapping when they are first needed.
+    Returns -1 if the file should be read the normal way instead.
+*/
+int editorOpenMapped(char *filename)
+{
+    struct stat st;
+    int fd = open(filename, O_RDONLY);
+
+    if(fd == -1)
+        return -1;
+    if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+            st.st_size < KILO_MMAP_THRESHOLD)
+    {
+        close(fd);
+        return -1;
+    }
+
+    /* rows are read from the mapping for as long as the file is open, so
+        it is mapped under a read lease where one can be had: another
+        program opening the file to write or truncate it waits until
+        editorMapPrivate made the rows already loaded safe. A file someone
+        else owns or already has open for writing, a log being written
+        say, gets no lease and is mapped as it is, and so is every file
+        without an event loop to hear of the lease breaking, as in the
+        benchmarks. Either way editorMapFault keeps a file cut short from
+        killing the editor, and the file watch opens it again. */
+    sigset_t mask;
+    pthread_sigmask(SIG_BLOCK, NULL, &mask);
+    int lease = sigismember(&mask, SIGIO) == 1 &&
+            fcntl(fd, F_SETLEASE, F_RDLCK) == 0;
+
+    size_t len = st.st_size;
+    const char *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(map == MAP_FAILED || !lease)
+        close(fd);
+    if(map == MAP_FAILED)
+        return -1;
+    if(E.mappage == 0)
+    {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = editorMapFault;
+        sa.sa_flags = SA_SIGINFO;
+        sigemptyset(&sa.sa_mask);
+        sigaction(SIGBUS, &sa, NULL);
+        E.mappage = sysconf(_SC_PAGESIZE);
+    }
+
+    /* the mapping is cut into slices that threads go through side by side,
+        which also spreads the page faults of reading it in over the cores */
+    struct loadSlice slice[KILO_LOAD_THREADS];
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    if(n > KILO_LOAD_THREADS)
+        n = KILO_LOAD_THREADS;
+    if(n > (long)(len / KILO_LOAD_SLICE))
+        n = len / KILO_LOAD_SLICE;
+    if(n < 1)
+        n = 1;
+    for(int i = 0; i < n; i++)
+    {
+        slice[i].map = map;
+        slice[i].from = len / n * i;
+        slice[i].to = i == n - 1 ? len : len / n * (i + 1);
+        slice[i].off = NULL;
+    }
+
+    // count the lines so the index can be allocated once
+    editorLoadRun(slice, n);
+    size_t lines = 0;
+    for(int i = 0; i < n; i++)
+        lines += slice[i].lines;
+    // a last line without a newline still counts
+    if(len > 0 && map[len - 1] != '\n')
+        lines++;
+    if(lines > 0x7fffffff)
+    {
+        munmap((void *)map, len);
+        return -1;
+    }
+
+    // every slice records the starts of the lines after its newlines, in place
+    E.lineoff = malloc(sizeof(size_t) * (lines + 1));
+    E.lineoff[0] = 0;
+    size_t *off = E.lineoff + 1;
+    for(int i = 0; i < n; off += slice[i++].lines)
+        slice[i].off = off;
+    editorLoadRun(slice, n);
+    E.lineoff[lines] = (map[len - 1] == '\n') ? len : len + 1;
+
+    // row sizes are ints, a file with a line too long for one is not opened
+    for(size_t i = 0; i < lines; i++)
+        if(E.lineoff[i + 1] - E.lineoff[i] - 1 > KILO_LINE_MAX)
+        {
+            errno = EFBIG;
+            die("open");
+        }
+
+    E.map = map;
+    E.maplen = len;
+    E.mapfd = lease ? fd : -1;
+    E.numrows = lines;
+    E.rows = lines ? rowTreeNode(0, lines) : NULL;
+    return 0;
+}
+
+/* function that lets the program waiting to write the mapped file go on
+    once the lease breaks. An unmodified buffer only gives the rows already
+    loaded from the mapping copies of their own, so what is on screen stays
+    as it was, and leaves the lines not loaded yet to the file watch, which
+    opens the file again. A modified buffer is going to save those lines,
+    so it swaps the whole mapping for a copy in one step, and rows not
+    loaded yet, and searches and saves reading the mapping meanwhile, all
+    see the file as it was opened. */
+void editorMapPrivate()
+{
+    if(E.map == NULL || E.mapfd == -1)
+        return;
+    void *copy = MAP_FAILED;
+    if(!E.dirty && E.save == NULL)
+    {
+        for(struct rownode *n = rowTreeFirst(); n; n = rowTreeNext(n))
+        {
+            erow *row = &n->row;
+            if(n->span || !row->borrowed || row->chars < E.map ||
+                    row->chars >= E.map + E.maplen)
+                continue;
+            int plain = row->render == row->chars;
+            editorRowDetach(row);
+            if(plain)
+                row->render = row->chars;
+        }
+    }
+    else if((copy = mmap(NULL, E.maplen, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) != MAP_FAILED)
+    {
+        memcpy(copy, E.map, E.maplen);
+        mprotect(copy, E.maplen, PROT_READ);
+        if(mremap(copy, E.maplen, E.maplen, MREMAP_MAYMOVE | MREMAP_FIXED,
+                (void *)E.map) == MAP_FAILED)
+        {
+            munmap(copy, E.maplen);
+            copy = MAP_FAILED;
+        }
+    }
+    if(copy == MAP_FAILED && (E.dirty || E.save))
+        editorSetStatusMessage("Cannot copy the file! Rows not shown yet may change: %s",
+                strerror(errno));
+    // the mapping may still hold the file open, so the lease is let go of first
+    fcntl(E.mapfd, F_SETLEASE, F_UNLCK);
+    close(E.mapfd);
+    E.mapfd = -1;
+}
+
+/* function that reads what is left of an open file, in one go for a regular
+    file and a block at a time for anything else, returns NULL if it fails */
+char *editorReadFile(int fd, size_t *lenp)
+{
+    struct stat st;
+    size_t len = 0, cap = KILO_LOAD_BLOCK;
+
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && (size_t)st.st_size >= cap)
+        cap = st.st_size + 1;
+    char *buf = malloc(cap);
+    ssize_t nread;
+    while((nread = read(fd, buf + len, cap - len)) != 0)
+    {
+        if(nread == -1)
+        {
+            if(errno == EINTR)
+                continue;
+            free(buf);
+            return NULL;
+        }
+        len += nread;
+        if(len == cap)
+        {
+            cap *= 2;
+            buf = realloc(buf, cap);
+        }
+    }
+    *lenp = len;
+    return buf;
+}
+
+/* function that splits s[0..len) into a tree of detached rows, read into
+    the arena if 'loaded' is set and owned by the rows otherwise, and stores
+    how many there are in 'count' */
+struct rownode *editorSplitRows(const char *s, size_t len, int loaded, int *count)
+{
+    struct rownode *rows = NULL;
+    const char *p = s, *end = s + len;
+
+    *count = 0;
+    while(p < end)
+    {
+        const char *q = memchr(p, '\n', end - p);
+        if(q == NULL)
+            q = end;
+        if(q - p > KILO_LINE_MAX)
+        {
+            errno = EFBIG;
+            die("read");
+        }
+        int linelen = q - p;
+        while(linelen > 0 && p[linelen - 1] == '\r')
+            linelen--;
+        rows = rowTreeMerge(rows, loaded ? editorLoadedRow(p, linelen) :
+                editorNewRow(p, linelen, NULL, 0));
+        (*count)++;
+        p = q + 1;
+    }
+    return rows;
+}
+
+/* function that reads a file too small to map in large blocks, splits it
+    into rows and links them into the tree all together */
+void editorOpenRead(char *filename)
+{
+    int fd = open(filename, O_RDONLY);
+    size_t len;
+
+    // if file not open, then print error
+    if(fd == -1)
+        die("open");
+    char *buf = editorReadFile(fd, &len);
+    if(buf == NULL)
+        die("read");
+    close(fd);
+
+    int count;
+    struct rownode *rows = editorSplitRows(buf, len, 1, &count);
+    free(buf);
+    if(count)
+        editorInsertRows(0, rows, count);
+}
+
+/* function that closes the buffer: the rows are not freed one by one, the
+    row storage goes as a whole, after anything still reading it is done */
+void editorCloseBuffer()
+{
+    editorSearchStop();
+    while(E.save)
+        editorSaveFinish();
+
+    editorHighlightForget(NULL);
+    rowStoreFree();
+    if(E.map)
+        munmap((void *)E.map, E.maplen);
+    if(E.mapfd != -1)
+        close(E.mapfd);
+    free(E.lineoff);
+    E.mapfd = -1;
+    E.map = NULL;
+    E.maplen = 0;
+    E.lineoff = NULL;
+    E.rows = NULL;
+    E.numrows = 0;
+    E.cx = E.cy = E.rx = 0;
+    E.rowoff = E.coloff = 0;
+    E.hlcp_len = E.hlcp_stale = E.hlcp_want = 0;
+    E.hlcp_damage = -1;
+    E.frame.valid = E.shadow.valid = 0;
+    E.dirty = 0;
+}
+
+//function to open editor with file
+void editorOpen(char *filename)
+{
+    // a buffer already open is let go of all at once
+    if(E.rows)
+        editorCloseBuffer();
+
+    // free filename
+    free(E.filename);
+    E.filename = strdup(filename);
+
+    editorSelectSyntaxHighlight();
+
+    if(editorOpenMapped(filename) != 0)
+        editorOpenRead(filename);
+    //reset buffer
+    E.dirty = 0;
+    editorWatchFile();
+}
+
+//function to save file
+void editorSave()
+{
+    // check if file name exists
+    if(E.filename == NULL)
+    {
+        // get file name from user for saving
+        E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
+        //abort save if file name not entered
+        if(E.filename == NULL)
+        {
+            editorSetStatusMessage("Save aborted");
+            return;
+        }
+        editorSelectSyntaxHighlight();
+    }
+
+    // a save already running writes the buffer again once it is done
+    if(E.save)
+    {
+        E.save->again = 1;
+        editorSetStatusMessage("Saving again when the current save is done");
+        return;
+    }
+
+    if(editorSaveStart(E.filename) == -1)
+        editorSetStatusMessage("Cannot save! I/O error: %s", strerror(errno));
+}
+
+/* file watch */
+/* function that watches the directory holding the file rather than the file,
+    since a save like ours puts a new file in its place, and notes what the
+    file is like now that the buffer matches it */
+void editorWatchFile()
+{
+    char last;
+
+    if(E.watchfd == -1 || E.filename == NULL)
+        return;
+    char *path = realpath(E.filename, NULL);
+    int fd = path ? open(path, O_RDONLY) : -1;
+    if(fd == -1)
+    {
+        free(path);
+        return;
+    }
+    fstat(fd, &E.disk);
+    E.disk_nl = E.disk.st_size == 0 ||
+            (pread(fd, &last, 1, E.disk.st_size - 1) == 1 && last == '\n');
+    close(fd);
+    E.watch_pending = 0;
+
+    // "/name" is watched through "/"
+    char *slash = strrchr(path, '/');
+    free(E.watchname);
+    E.watchname = strdup(slash + 1);
+    slash[slash == path] = '\0';
+    int wd = inotify_add_watch(E.watchfd, path,
+            IN_CLOSE_WRITE | IN_MODIFY | IN_MOVED_TO | IN_CREATE);
+    if(E.watchwd != -1 && E.watchwd != wd)
+        inotify_rm_watch(E.watchfd, E.watchwd);
+    E.watchwd = wd;
+    free(path);
+}
+
+/* function that reads what happened in the watched directory, the file is
+    checked once the event loop gets to it */
+void editorWatchPoll()
+{
+    union { struct inotify_event ev; char buf[4096]; } u;
+    ssize_t n;
+
+    while((n = read(E.watchfd, u.buf, sizeof(u.buf))) > 0)
+    {
+        char *p = u.buf;
+        while(p < u.buf + n)
+        {
+            struct inotify_event *ev = (struct inotify_event *)p;
+            // events that did not fit in the queue may have been about the file
+            if(ev->mask & IN_Q_OVERFLOW ||
+                    (ev->wd == E.watchwd && ev->len && !strcmp(ev->name, E.watchname)))
+                E.watch_pending = 1;
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+}
+
+// function that returns 1 if two lines are the same
+int reloadSame(const struct reloadLine *a, const struct reloadLine *b)
+{
+    return a->hash == b->hash && a->len == b->len && !memcmp(a->s, b->s, a->len);
+}
+
+// function that finds the slot of a line, or the empty one it would go in
+struct reloadSlot *reloadFind(struct reloadSlot *slot, int size,
+        const struct reloadLine *old, const struct reloadLine *l)
+{
+    unsigned int h = l->hash & (size - 1);
+
+    while(slot[h].old != -1 && !reloadSame(&old[slot[h].old], l))
+        h = (h + 1) & (size - 1);
+    return &slot[h];
+}
+
+// function that moves row index 'y' past 'del' rows at 'at' being replaced by 'count'
+int reloadShift(int y, int at, int del, int count)
+{
+    if(y >= at + del)
+        return y + count - del;
+    if(y >= at + count)
+        return count ? at + count - 1 : at;
+    return y;
+}
+
+/* function that replaces 'del' rows at 'at' with 'count' lines, the cursor
+    and the screen stay on the rows they were on */
+void editorReloadRows(int at, int del, const struct reloadLine *line, int count)
+{
+    struct rownode *rows = NULL;
+    int i;
+
+    for(i = 0; i < del; i++)
+        editorDelRow(at);
+    for(i = 0; i < count; i++)
+        rows = rowTreeMerge(rows, editorNewRow(line[i].s, line[i].len, NULL, 0));
+    if(count)
+        editorInsertRows(at, rows, count);
+    E.cy = reloadShift(E.cy, at, del, count);
+    E.rowoff = reloadShift(E.rowoff, at, del, count);
+}
+
+/* function that loads the bytes a file grew by from 'from' to 'to' as new
+    rows, returns how many lines it read in, or -1 if the bytes just before
+    the old end are not the last rows of the buffer and the file was
+    rewritten instead */
+int editorReloadAppend(int fd, off_t from, off_t to)
+{
+    char disk[KILO_WATCH_VERIFY], have[KILO_WATCH_VERIFY];
+    int pos = from < KILO_WATCH_VERIFY ? from : KILO_WATCH_VERIFY;
+    erow *row = editorRowAt(E.numrows - 1);
+
+    if(pread(fd, disk, pos, from - pos) != pos)
+        return -1;
+    if(E.disk_nl && pos > 0 && disk[--pos] != '\n')
+        return -1;
+    while(pos > 0 && row)
+    {
+        int len = row->size < pos ? row->size : pos;
+        editorRowCopy(row, row->size - len, row->size, have);
+        if(memcmp(have, disk + pos - len, len))
+            return -1;
+        pos -= len;
+        if(pos > 0 && disk[--pos] != '\n')
+            return -1;
+        row = editorRowPrev(row);
+    }
+    if(pos > 0)
+        return -1;
+
+    // only the new bytes are read, whatever the file lost meanwhile is not
+    size_t len = 0;
+    char *buf = malloc(to - from);
+    while(len < (size_t)(to - from))
+    {
+        ssize_t nread = pread(fd, buf + len, to - from - len, from + len);
+        if(nread == -1 && errno == EINTR)
+            continue;
+        if(nread <= 0)
+            break;
+        len += nread;
+    }
+
+    // a last line without its newline goes on where the file stopped
+    char *p = buf, *end = buf + len;
+    int oldrows = E.numrows, count;
+    if(!E.disk_nl && oldrows && p < end)
+    {
+        char *q = memchr(p, '\n', end - p);
+        if((q ? q : end) - p > KILO_LINE_MAX - editorRowAt(oldrows - 1)->size)
+        {
+            errno = EFBIG;
+            die("read");
+        }
+        int linelen = (q ? q : end) - p;
+        while(linelen > 0 && p[linelen - 1] == '\r')
+            linelen--;
+        editorRowAppendString(editorRowAt(oldrows - 1), p, linelen);
+        p = q ? q + 1 : end;
+    }
+    struct rownode *rows = editorSplitRows(p, end - p, 0, &count);
+    if(count)
+        editorInsertRows(E.numrows, rows, count);
+    if(len)
+        E.disk_nl = buf[len - 1] == '\n';
+    free(buf);
+
+    // a cursor at the end of the file follows it, like tail -f
+    if(oldrows && E.cy >= oldrows - 1)
+        E.cy += E.numrows - oldrows;
+    return count;
+}
+
+/* function that compares the rows with the lines of a file rewritten on
+    disk by their hashes and replaces only the rows that differ, returns how
+    many lines changed, or -1 if the file cannot be read */
+int editorReloadDiff(int fd)
+{
+    size_t len;
+    char *buf = editorReadFile(fd, &len);
+    int i, j, k;
+
+    if(buf == NULL)
+        return -1;
+
+    // the lines of the file and the rows of the buffer, hashed
+    int n = 0, cap = 64, m = E.numrows;
+    struct reloadLine *line = malloc(sizeof(struct reloadLine) * cap);
+    const char *p = buf, *end = buf + len;
+    while(p < end)
+    {
+        const char *q = memchr(p, '\n', end - p);
+        if(q == NULL)
+            q = end;
+        int linelen = q - p;
+        while(linelen > 0 && p[linelen - 1] == '\r')
+            linelen--;
+        if(n == cap)
+        {
+            cap *= 2;
+            line = realloc(line, sizeof(struct reloadLine) * cap);
+        }
+        line[n].s = p;
+        line[n].len = linelen;
+        line[n++].hash = editorKeywordHash(p, linelen, 0);
+        p = q + 1;
+    }
+    struct reloadLine *old = malloc(sizeof(struct reloadLine) * (m + 1));
+    i = 0;
+    for(erow *row = editorRowAt(0); row; row = editorRowNext(row), i++)
+    {
+        editorRowFlat(row);
+        old[i].s = row->chars;
+        old[i].len = row->size;
+        old[i].hash = editorKeywordHash(row->chars, row->size, 0);
+    }
+
+    // the lines the two start and end with stay
+    int pre = 0, suf = 0;
+    while(pre < n && pre < m && reloadSame(&old[pre], &line[pre]))
+        pre++;
+    while(suf < n - pre && suf < m - pre && reloadSame(&old[m - 1 - suf], &line[n - 1 - suf]))
+        suf++;
+
+    /* in between, lines found once in the buffer and once in the file are
+        matched up in order and stay as well, the rows between them go. The
+        first and last pair stand for the lines around the changes. */
+    int dm = m - pre - suf, dn = n - pre - suf, na = 0;
+    int *anchor = malloc(sizeof(int) * 2 * (dn + 2));
+    anchor[na++] = pre - 1;
+    anchor[na++] = pre - 1;
+    if(dm && dn)
+    {
+        int size = 16;
+        while(size < 2 * dm)
+            size *= 2;
+        struct reloadSlot *slot = malloc(sizeof(struct reloadSlot) * size);
+        for(k = 0; k < size; k++)
+        {
+            slot[k].old = -1;
+            slot[k].nold = slot[k].nnew = 0;
+        }
+        for(i = pre; i < pre + dm; i++)
+        {
+            struct reloadSlot *s = reloadFind(slot, size, old, &old[i]);
+            if(s->old == -1)
+                s->old = i;
+            s->nold++;
+        }
+        for(j = pre; j < pre + dn; j++)
+        {
+            struct reloadSlot *s = reloadFind(slot, size, old, &line[j]);
+            if(s->old != -1)
+                s->nnew++;
+        }
+        for(j = pre; j < pre + dn; j++)
+        {
+            struct reloadSlot *s = reloadFind(slot, size, old, &line[j]);
+            if(s->old > anchor[na - 2] && s->nold == 1 && s->nnew == 1)
+            {
+                anchor[na++] = s->old;
+                anchor[na++] = j;
+            }
+        }
+        free(slot);
+    }
+    anchor[na++] = pre + dm;
+    anchor[na++] = pre + dn;
+
+    // the rows between matched lines are replaced from the bottom up, so the ones above keep their index
+    int changed = 0;
+    for(k = na - 2; k > 0; k -= 2)
+    {
+        int at = anchor[k - 2] + 1, del = anchor[k] - at;
+        int from = anchor[k - 1] + 1, count = anchor[k + 1] - from;
+        if(del || count)
+            editorReloadRows(at, del, &line[from], count);
+        changed += del > count ? del : count;
+    }
+    E.disk_nl = len == 0 || buf[len - 1] == '\n';
+
+    free(anchor);
+    free(old);
+    free(line);
+    free(buf);
+    return changed;
+}
+
+/* function that brings an unmodified buffer up to date with the file after
+    it changed on disk: an append has only the new lines read in, anything
+    else has only the rows that differ replaced, so the rest keep their
+    colors. Returns 1 if the screen needs a redraw. */
+int editorReloadCheck()
+{
+    struct stat st, old = E.disk;
+    int fd = E.filename ? open(E.filename, O_RDONLY) : -1, lines;
+
+    // a file that went away leaves the buffer as it is
+    E.watch_pending = 0;
+    if(fd == -1)
+        return 0;
+    if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) ||
+            (st.st_dev == old.st_dev && st.st_ino == old.st_ino &&
+            st.st_size == old.st_size && st.st_mtim.tv_sec == old.st_mtim.tv_sec &&
+            st.st_mtim.tv_nsec == old.st_mtim.tv_nsec))
+    {
+        close(fd);
+        return 0;
+    }
+    E.disk = st;
+
+    if(E.dirty)
+    {
+        editorSetStatusMessage("File changed on disk! Saving writes over it");
+    }
+    else if(st.st_dev == old.st_dev && st.st_ino == old.st_ino &&
+            st.st_size > old.st_size &&
+            (lines = editorReloadAppend(fd, old.st_size, st.st_size)) >= 0)
+    {
+        editorSetStatusMessage("File grew on disk, %d lines read in", lines);
+        E.dirty = 0;
+    }
+    else if(E.map || st.st_size >= KILO_MMAP_THRESHOLD)
+    {
+        // a file this large is opened lazily again instead of read whole to compare
+        char *filename = strdup(E.filename);
+        int cy = E.cy, cx = E.cx, rowoff = E.rowoff;
+        editorOpen(filename);
+        free(filename);
+        E.cy = cy;
+        E.cx = cx;
+        E.rowoff = rowoff;
+        editorSetStatusMessage("File changed on disk, opened again");
+    }
+    else if((lines = editorReloadDiff(fd)) >= 0)
+    {
+        editorSetStatusMessage("File changed on disk, %d lines reloaded", lines);
+        E.dirty = 0;
+    }
+    else
+    {
+        editorSetStatusMessage("Cannot reload! I/O error: %s", strerror(errno));
+    }
+    close(fd);
+
+    // the cursor stays on a row, and in it
+    if(E.cy > E.numrows)
+        E.cy = E.numrows;
+    if(E.rowoff > E.cy)
+        E.rowoff = E.cy;
+    erow *row = editorRowAt(E.cy);
+    int rowlen = row ? row->size : 0;
+    if(E.cx > rowlen)
+        E.cx = rowlen;
+    return 1;
+}
+
+
+
+/* search */
+// function that prepares a query for searchFind
+void searchCompile(struct searchNeedle *nd, const char *query, int nocase)
+{
+    int i;
+
+    nd->len = strlen(query);
+    nd->nocase = nocase;
+    nd->has_space = strchr(query, ' ') != NULL;
+    nd->s = malloc(nd->len + 1);
+    for(i = 0; i <= nd->len; i++)
+        nd->s[i] = nocase ? ASCII_LOWER(query[i]) : query[i];
+
+    if(nd->len < KILO_SEARCH_LONG)
+        return;
+
+    // how far the window may slide when its last byte is 'c'
+    for(i = 0; i < 256; i++)
+        nd->shift[i] = nd->len;
+    for(i = 0; i < nd->len - 1; i++)
+    {
+        unsigned char c = nd->s[i];
+        nd->shift[c] = nd->len - 1 - i;
+        if(nocase)
+            nd->shift[ASCII_UPPER(c)] = nd->len - 1 - i;
+    }
+}
+
+// function that frees a compiled query
+void searchFree(struct searchNeedle *nd)
+{
+    free(nd->s);
+    nd->s = NULL;
+}
+
+// function that returns true if the needle occurs at 'h'
+int searchEqual(const struct searchNeedle *nd, const char *h)
+{
+    if(!nd->nocase)
+        return memcmp(h, nd->s, nd->len) == 0;
+    for(int i = 0; i < nd->len; i++)
+        if(ASCII_LOWER((unsigned char)h[i]) != (unsigned char)nd->s[i])
+            return 0;
+    return 1;
+}
+
+// function that returns the first occurrence of the needle in h[0..len), or NULL
+const char *searchFind(const struct searchNeedle *nd, const char *h, size_t len)
+{
+    size_t n = nd->len, i = 0;
+
+    if(n == 0)
+        return h;
+    if(len < n)
+        return NULL;
+
+    unsigned char first = nd->s[0], last = nd->s[n - 1];
+
+    if(n >= KILO_SEARCH_LONG)
+    {
+        // Horspool: check the byte under the end of the window, then skip ahead
+        while(i + n <= len)
+        {
+            unsigned char c = h[i + n - 1];
+            if((nd->nocase ? ASCII_LOWER(c) : c) == last && searchEqual(nd, h + i))
+                return h + i;
+            i += nd->shift[c];
+        }
+        return NULL;
+    }
+
+    /* short needles: compare a vector of window starts with the first byte and
+        of window ends with the last byte, only windows where both agree are
+        compared in full */
+#if defined(__AVX2__) || defined(__SSE2__)
+    char fu = nd->nocase ? ASCII_UPPER(first) : first;
+    char lu = nd->nocase ? ASCII_UPPER(last) : last;
+#endif
+#if defined(__AVX2__)
+    __m256i wf = _mm256_set1_epi8(first), wF = _mm256_set1_epi8(fu);
+    __m256i wl = _mm256_set1_epi8(last), wL = _mm256_set1_epi8(lu);
+
+    while(i + n - 1 + 32 <= len)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(h + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(h + i + n - 1));
+        __m256i m = _mm256_and_si256(
+                _mm256_or_si256(_mm256_cmpeq_epi8(a, wf), _mm256_cmpeq_epi8(a, wF)),
+                _mm256_or_si256(_mm256_cmpeq_epi8(b, wl), _mm256_cmpeq_epi8(b, wL)));
+        unsigned int bits = _mm256_movemask_epi8(m);
+        while(bits)
+        {
+            const char *p = h + i + __builtin_ctz(bits);
+            if(searchEqual(nd, p))
+                return p;
+            bits &= bits - 1;
+        }
+        i += 32;
+    }
+#endif
+#if defined(__SSE2__)
+    __m128i vf = _mm_set1_epi8(first), vF = _mm_set1_epi8(fu);
+    __m128i vl = _mm_set1_epi8(last), vL = _mm_set1_epi8(lu);
+
+    while(i + n - 1 + 16 <= len)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i *)(h + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(h + i + n - 1));
+        __m128i m = _mm_and_si128(
+                _mm_or_si128(_mm_cmpeq_epi8(a, vf), _mm_cmpeq_epi8(a, vF)),
+                _mm_or_si128(_mm_cmpeq_epi8(b, vl), _mm_cmpeq_epi8(b, vL)));
+        unsigned int bits = _mm_movemask_epi8(m);
+        while(bits)
+        {
+            const char *p = h + i + __builtin_ctz(bits);
+            if(searchEqual(nd, p))
+                return p;
+            bits &= bits - 1;
+        }
+        i += 16;
+    }
+#endif
+    // scalar tail, and the whole scan on other machines
+    if(!nd->nocase)
+    {
+        const char *p;
+        for(; i + n <= len && (p = memchr(h + i, first, len - n + 1 - i)); )
+        {
+            if(searchEqual(nd, p))
+                return p;
+            i = p - h + 1;
+        }
+        return NULL;
+    }
+    for(; i + n <= len; i++)
+    {
+        unsigned char c = h[i];
+        if((nd->nocase ? ASCII_LOWER(c) : c) == first && searchEqual(nd, h + i))
+            return h + i;
+    }
+    return NULL;
+}
+
+/* function that returns the first (dir 1) or last (dir -1) place in s[0..len)
+    a line could match: an occurrence of the needle, or a tab when the needle
+    has a space in it */
+const char *searchRegion(const struct searchNeedle *nd, const char *s,
+        size_t len, int dir)
+{
+    const char *p, *t = NULL;
+
+    if(nd->len == 0)
+        return dir > 0 ? s : s + len;
+
+    // the needle has no tabs, so no occurrence reaches past the first tab
+    if(dir > 0)
+    {
+        if(nd->has_space)
+            t = memchr(s, '\t', len);
+        p = searchFind(nd, s, t ? (size_t)(t - s) : len);
+        return p ? p : t;
+    }
+
+    // walk back a window at a time, keeping the last hit inside the window
+    size_t end = len;
+    while(end > 0)
+    {
+        size_t start = end > KILO_SEARCH_WINDOW ? end - KILO_SEARCH_WINDOW : 0;
+        size_t stop = end + nd->len - 1 < len ? end + nd->len - 1 : len;
+        const char *last = NULL;
+
+        if(nd->has_space && (t = memrchr(s + start, '\t', end - start)))
+            start = t - s + 1;
+        for(size_t i = start; (p = searchFind(nd, s + i, stop - i)); )
+        {
+            last = p;
+            i = p - s + 1;
+        }
+        if(last || t)
+            return last ? last : t;
+        end = start;
+    }
+    return NULL;
+}
+
+/* regex */
+// function that adds symbol 'c' to a set, with its other case when folding
+void regexSetAdd(unsigned char *set, int c, int nocase)
+{
+    set[c >> 3] |= 1 << (c & 7);
+    if(nocase && c < 256 && ASCII_LOWER(c) != ASCII_UPPER(c))
+    {
+        int o = (c == ASCII_LOWER(c)) ? ASCII_UPPER(c) : ASCII_LOWER(c);
+        set[o >> 3] |= 1 << (o & 7);
+    }
+}
+
+// function that returns true if symbol 'c' is in a set
+int regexSetHas(const unsigned char *set, int c)
+{
+    return (set[c >> 3] >> (c & 7)) & 1;
+}
+
+struct regexParser
+{
+    const char *p; // next character of the pattern
+    struct regexNode *node;
+    int n, cap;
+    int nocase;
+};
+
+// function that adds a node to the parse tree and returns its index
+int regexNodeNew(struct regexParser *ps, int op, int a, int b)
+{
+    if(ps->n == ps->cap)
+    {
+        ps->cap = ps->cap ? ps->cap * 2 : 16;
+        ps->node = realloc(ps->node, sizeof(struct regexNode) * ps->cap);
+    }
+    ps->node[ps->n].op = op;
+    ps->node[ps->n].a = a;
+    ps->node[ps->n].b = b;
+    memset(ps->node[ps->n].set, 0, sizeof(ps->node[ps->n].set));
+    return ps->n++;
+}
+
+// function that adds the class of escape '\c' to a set, returning false for other escapes
+int regexEscapeClass(unsigned char *set, int c)
+{
+    int neg = isupper(c), i;
+    unsigned char tmp[RX_SYMBOLS / 8 + 1] = { 0 };
+
+    switch(tolower(c))
+    {
+        case 'd':
+            for(i = '0'; i <= '9'; i++)
+                regexSetAdd(tmp, i, 0);
+            break;
+        case 'w':
+            for(i = 0; i < 256; i++)
+                if(isalnum(i) || i == '_')
+                    regexSetAdd(tmp, i, 0);
+            break;
+        case 's':
+            for(i = 0; i < 256; i++)
+                if(isspace(i))
+                    regexSetAdd(tmp, i, 0);
+            break;
+        default:
+            return 0;
+    }
+    for(i = 0; i < 256; i++)
+        if(regexSetHas(tmp, i) != neg)
+            regexSetAdd(set, i, 0);
+    return 1;
+}
+
+// function that returns the byte an escape '\c' stands for
+int regexEscapeChar(int c)
+{
+    switch(c)
+    {
+        case 'n':
+            return '\n';
+        case 't':
+            return '\t';
+        case 'r':
+            return '\r';
+        default:
+            return c;
+    }
+}
+
+int regexParseAlt(struct regexParser *ps);
+
+// function that parses a bracket expression, '[' already read
+int regexParseClass(struct regexParser *ps)
+{
+    int node = regexNodeNew(ps, RXN_SET, -1, -1), neg = 0, i;
+    unsigned char set[RX_SYMBOLS / 8 + 1] = { 0 };
+
+    if(*ps->p == '^')
+    {
+        neg = 1;
+        ps->p++;
+    }
+    // a ']' right at the start is an ordinary member
+    for(int first = 1; *ps->p && (first || *ps->p != ']'); first = 0)
+    {
+        int lo = (unsigned char)*ps->p++;
+        if(lo == '\\' && *ps->p)
+        {
+            if(regexEscapeClass(set, *ps->p))
+            {
+                ps->p++;
+                continue;
+            }
+            lo = regexEscapeChar((unsigned char)*ps->p++);
+        }
+
+        int hi = lo;
+        if(ps->p[0] == '-' && ps->p[1] && ps->p[1] != ']')
+        {
+            hi = (unsigned char)ps->p[1];
+            ps->p += 2;
+            if(hi == '\\' && *ps->p)
+                hi = regexEscapeChar((unsigned char)*ps->p++);
+            if(hi < lo)
+                return -1;
+        }
+        for(i = lo; i <= hi; i++)
+            regexSetAdd(set, i, ps->nocase);
+    }
+    if(*ps->p != ']')
+        return -1;
+    ps->p++;
+
+    for(i = 0; i < 256; i++)
+        if(regexSetHas(set, i) != neg)
+            regexSetAdd(ps->node[node].set, i, 0);
+    return node;
+}
+
+// function that parses a single character, class or parenthesized group
+int regexParseAtom(struct regexParser *ps)
+{
+    int c = (unsigned char)*ps->p++, node, i;
+
+    switch(c)
+    {
+        case '(':
+            node = regexParseAlt(ps);
+            if(node < 0 || *ps->p != ')')
+                return -1;
+            ps->p++;
+            return node;
+        case '[':
+            return regexParseClass(ps);
+        case '*':
+        case '+':
+        case '?':
+            return -1; // nothing to repeat
+    }
+
+    node = regexNodeNew(ps, RXN_SET, -1, -1);
+    unsigned char *set = ps->node[node].set;
+    if(c == '.')
+    {
+        for(i = 0; i < 256; i++)
+            regexSetAdd(set, i, 0);
+    }
+    else if(c == '^' || c == '$')
+    {
+        ps->node[node].op = RXN_ASSERT;
+        ps->node[node].a = c == '^' ? RX_BOL : RX_EOL;
+    }
+    else if(c == '\\' && *ps->p)
+    {
+        c = (unsigned char)*ps->p++;
+        if(!regexEscapeClass(set, c))
+            regexSetAdd(set, regexEscapeChar(c), ps->nocase);
+    }
+    else
+    {
+        regexSetAdd(set, c, ps->nocase);
+    }
+    return node;
+}
+
+// function that parses an atom followed by any number of '*', '+' and '?'
+int regexParseRepeat(struct regexParser *ps)
+{
+    int node = regexParseAtom(ps);
+
+    while(node >= 0 && (*ps->p == '*' || *ps->p == '+' || *ps->p == '?'))
+    {
+        int op = *ps->p == '*' ? RXN_STAR : *ps->p == '+' ? RXN_PLUS : RXN_QUEST;
+        ps->p++;
+        node = regexNodeNew(ps, op, node, -1);
+    }
+    return node;
+}
+
+// function that parses a sequence, which may be empty
+int regexParseCat(struct regexParser *ps)
+{
+    int node = -1;
+
+    while(*ps->p && *ps->p != '|' && *ps->p != ')')
+    {
+        int next = regexParseRepeat(ps);
+        if(next < 0)
+            return -1;
+        node = node < 0 ? next : regexNodeNew(ps, RXN_CAT, node, next);
+    }
+    return node < 0 ? regexNodeNew(ps, RXN_EMPTY, -1, -1) : node;
+}
+
+// function that parses alternatives separated by '|'
+int regexParseAlt(struct regexParser *ps)
+{
+    int node = regexParseCat(ps);
+
+    while(node >= 0 && *ps->p == '|')
+    {
+        ps->p++;
+        int next = regexParseCat(ps);
+        node = next < 0 ? -1 : regexNodeNew(ps, RXN_ALT, node, next);
+    }
+    return node;
+}
+
+// function that adds an instruction to a program and returns its index
+int regexEmit(struct regex *re, int op, int out, int out1, const unsigned char *set)
+{
+    if((re->nnfa & (re->nnfa - 1)) == 0)
+        re->nfa = realloc(re->nfa,
+                sizeof(struct regexState) * (re->nnfa ? re->nnfa * 2 : 1));
+    re->nfa[re->nnfa].op = op;
+    re->nfa[re->nnfa].out = out;
+    re->nfa[re->nnfa].out1 = out1;
+    if(set)
+        memcpy(re->nfa[re->nnfa].set, set, sizeof(re->nfa[re->nnfa].set));
+    return re->nnfa++;
+}
+
+/* function that compiles node 'i' so it continues at instruction 'next',
+    returning its entry, 'reverse' compiles a program matching backwards */
+int regexCompileNode(struct regex *re, const struct regexNode *node, int i,
+        int next, int reverse)
+{
+    const struct regexNode *nd = &node[i];
+    int s, body;
+
+    switch(nd->op)
+    {
+        case RXN_SET:
+            return regexEmit(re, RX_SET, next, -1, nd->set);
+        case RXN_ASSERT:
+            return regexEmit(re, RX_ASSERT, next, nd->a, NULL);
+        case RXN_CAT:
+            if(reverse)
+                return regexCompileNode(re, node, nd->b,
+                        regexCompileNode(re, node, nd->a, next, 1), 1);
+            return regexCompileNode(re, node, nd->a,
+                    regexCompileNode(re, node, nd->b, next, 0), 0);
+        case RXN_ALT:
+            s = regexCompileNode(re, node, nd->a, next, reverse);
+            return regexEmit(re, RX_SPLIT, s,
+                    regexCompileNode(re, node, nd->b, next, reverse), NULL);
+        case RXN_STAR:
+        case RXN_PLUS:
+            s = regexEmit(re, RX_SPLIT, -1, next, NULL);
+            body = regexCompileNode(re, node, nd->a, s, reverse);
+            re->nfa[s].out = body;
+            return nd->op == RXN_STAR ? s : body;
+        case RXN_QUEST:
+            return regexEmit(re, RX_SPLIT,
+                    regexCompileNode(re, node, nd->a, next, reverse), next, NULL);
+    }
+    return next;
+}
+
+// function that returns the one byte a set holds, the lower case one for a case pair, or -1
+int regexSetByte(const unsigned char *set, int nocase)
+{
+    int c, found = -1, count = 0;
+
+    for(c = 0; c < RX_SYMBOLS; c++)
+        if(regexSetHas(set, c))
+        {
+            count++;
+            if(found < 0)
+                found = c;
+        }
+    if(found >= 256)
+        return -1;
+    if(count == 1)
+        return found;
+    if(count == 2 && nocase && ASCII_UPPER(found) != ASCII_LOWER(found) &&
+            regexSetHas(set, ASCII_LOWER(found)))
+        return ASCII_LOWER(found);
+    return -1;
+}
+
+/* function that walks a chain of RXN_CAT nodes in order, collecting runs of
+    single bytes into 'run' and keeping the longest in 'best' */
+void regexLiteral(const struct regexNode *node, int i, int nocase, char *run,
+        int *runlen, char *best, int *bestlen)
+{
+    int c;
+
+    if(node[i].op == RXN_CAT)
+    {
+        regexLiteral(node, node[i].a, nocase, run, runlen, best, bestlen);
+        regexLiteral(node, node[i].b, nocase, run, runlen, best, bestlen);
+        return;
+    }
+    if(node[i].op == RXN_SET && (c = regexSetByte(node[i].set, nocase)) > 0 &&
+            c != '\t')
+    {
+        run[(*runlen)++] = c;
+        if(*runlen > *bestlen)
+        {
+            *bestlen = *runlen;
+            memcpy(best, run, *runlen);
+        }
+        return;
+    }
+    *runlen = 0;
+}
+
+// function that compiles a pattern, returning NULL if it is not a valid regex
+struct regex *regexCompile(const char *pattern, int nocase)
+{
+    struct regexParser ps = { pattern, NULL, 0, 0, nocase };
+    int root = regexParseAlt(&ps), i, c, n;
+
+    if(root < 0 || *ps.p)
+    {
+        free(ps.node);
+        return NULL;
+    }
+
+    struct regex *re = calloc(1, sizeof(struct regex));
+    int match = regexEmit(re, RX_MATCH, -1, -1, NULL);
+    re->fwd = regexCompileNode(re, ps.node, root, match, 0);
+    re->rev = regexCompileNode(re, ps.node, root, match, 1);
+
+    // split the bytes into classes every instruction treats alike, events get their own
+    re->cls[RX_BOL] = 1;
+    re->cls[RX_EOL] = 2;
+    re->nclasses = 3;
+    for(i = 0; i < re->nnfa; i++)
+    {
+        int remap[RX_SYMBOLS][2];
+        if(re->nfa[i].op != RX_SET)
+            continue;
+        for(c = 0; c < re->nclasses; c++)
+            remap[c][0] = remap[c][1] = -1;
+        for(n = 0, c = 0; c < RX_SYMBOLS; c++)
+        {
+            int *to = &remap[re->cls[c]][regexSetHas(re->nfa[i].set, c)];
+            if(*to < 0)
+                *to = n++;
+            re->cls[c] = *to;
+        }
+        re->nclasses = n;
+    }
+
+    // a literal every match holds lets the substring scan skip most lines
+    char *run = malloc(strlen(pattern) + 1), *best = malloc(strlen(pattern) + 1);
+    int runlen = 0, bestlen = 0;
+    regexLiteral(ps.node, root, nocase, run, &runlen, best, &bestlen);
+    best[bestlen] = '\0';
+    re->haslit = bestlen > 0;
+    searchCompile(&re->lit, best, nocase);
+    free(run);
+    free(best);
+    free(ps.node);
+    return re;
+}
+
+// function that frees a compiled regex
+void regexFree(struct regex *re)
+{
+    if(!re)
+        return;
+    searchFree(&re->lit);
+    free(re->nfa);
+    free(re);
+}
+
+// function that throws away every state of a DFA
+void regexDfaFlush(struct regexDfa *d)
+{
+    d->n = 0;
+    d->npool = 0;
+    d->init = -1;
+    d->flushes++;
+    memset(d->table, 0, sizeof(int) * 2 * KILO_REGEX_STATES);
+}
+
+// function that sets up an empty DFA running program 'entry' of a regex
+void regexDfaInit(struct regexDfa *d, const struct regex *re, int entry, int unanchored)
+{
+    d->re = re;
+    d->entry = entry;
+    d->unanchored = unanchored;
+    d->next = malloc(sizeof(int) * KILO_REGEX_STATES * re->nclasses);
+    d->setoff = malloc(sizeof(int) * (KILO_REGEX_STATES + 1));
+    d->accept = malloc(KILO_REGEX_STATES);
+    d->table = malloc(sizeof(int) * 2 * KILO_REGEX_STATES);
+    d->pool = NULL;
+    d->cappool = 0;
+    d->mark = calloc(re->nnfa, sizeof(int));
+    d->gen = 0;
+    d->stack = malloc(sizeof(int) * re->nnfa);
+    d->work = malloc(sizeof(int) * re->nnfa);
+    d->flushes = 0;
+    regexDfaFlush(d);
+}
+
+// function that frees the states of a DFA
+void regexDfaFree(struct regexDfa *d)
+{
+    free(d->next);
+    free(d->setoff);
+    free(d->accept);
+    free(d->table);
+    free(d->pool);
+    free(d->mark);
+    free(d->stack);
+    free(d->work);
+}
+
+/* function that adds instruction 's' and all it reaches without reading a byte
+    to 'work', going past assertions on 'event' (RX_BOL, RX_EOL or -1), other
+    assertions wait in the set */
+void regexClosure(struct regexDfa *d, int s, int *n, int event)
+{
+    const struct regexState *nfa = d->re->nfa;
+    int top = 0;
+
+    d->stack[top++] = s;
+    while(top > 0)
+    {
+        s = d->stack[--top];
+        if(s < 0 || d->mark[s] == d->gen)
+            continue;
+        d->mark[s] = d->gen;
+        if(nfa[s].op == RX_SPLIT)
+        {
+            d->stack[top++] = nfa[s].out1;
+            d->stack[top++] = nfa[s].out;
+        }
+        else if(nfa[s].op == RX_ASSERT && nfa[s].out1 == event)
+        {
+            d->stack[top++] = nfa[s].out;
+        }
+        else
+        {
+            d->work[(*n)++] = s;
+        }
+    }
+}
+
+int regexIntCmp(const void *a, const void *b)
+{
+    return *(const int *)a - *(const int *)b;
+}
+
+// function that returns the DFA state for the 'n' NFA states in 'work', adding it if new
+int regexDfaState(struct regexDfa *d, int n)
+{
+    unsigned int h = 2166136261u;
+    int i, slot;
+
+    qsort(d->work, n, sizeof(int), regexIntCmp);
+    for(i = 0; i < n; i++)
+        h = (h ^ d->work[i]) * 16777619u;
+
+    for(slot = h & (2 * KILO_REGEX_STATES - 1); d->table[slot];
+            slot = (slot + 1) & (2 * KILO_REGEX_STATES - 1))
+    {
+        int k = d->table[slot] - 1;
+        if(d->setoff[k + 1] - d->setoff[k] == n &&
+                !memcmp(d->pool + d->setoff[k], d->work, sizeof(int) * n))
+            return k;
+    }
+
+    // the cache is full: start over, the caller's state numbers go stale
+    if(d->n == KILO_REGEX_STATES)
+    {
+        regexDfaFlush(d);
+        return regexDfaState(d, n);
+    }
+
+    if(d->npool + n > d->cappool)
+    {
+        d->cappool = (d->npool + n) * 2;
+        d->pool = realloc(d->pool, sizeof(int) * d->cappool);
+    }
+    memcpy(d->pool + d->npool, d->work, sizeof(int) * n);
+    d->setoff[d->n] = d->npool;
+    d->npool += n;
+    d->setoff[d->n + 1] = d->npool;
+    d->accept[d->n] = 0;
+    for(i = 0; i < n; i++)
+        if(d->re->nfa[d->work[i]].op == RX_MATCH)
+            d->accept[d->n] = 1;
+    for(i = 0; i < d->re->nclasses; i++)
+        d->next[d->n * d->re->nclasses + i] = -1;
+    d->table[slot] = d->n + 1;
+    return d->n++;
+}
+
+// function that returns the state a DFA starts in
+int regexDfaStart(struct regexDfa *d)
+{
+    int n = 0;
+
+    if(d->init < 0)
+    {
+        d->gen++;
+        regexClosure(d, d->entry, &n, -1);
+        d->init = regexDfaState(d, n);
+    }
+    return d->init;
+}
+
+// function that returns the state after 'state' reads symbol 'sym'
+int regexDfaStep(struct regexDfa *d, int state, int sym)
+{
+    const struct regex *re = d->re;
+    int *slot = &d->next[state * re->nclasses + re->cls[sym]];
+    int i, n = 0, flushes = d->flushes, next;
+
+    if(*slot >= 0)
+        return *slot;
+
+    /* a byte moves every instruction that takes it on by one, an event takes
+        no room, so every instruction stays and assertions waiting on it go on */
+    d->gen++;
+    for(i = d->setoff[state]; i < d->setoff[state + 1]; i++)
+    {
+        int k = d->pool[i];
+        const struct regexState *st = &re->nfa[k];
+        if(sym < 256)
+        {
+            if(st->op == RX_SET && regexSetHas(st->set, sym))
+                regexClosure(d, st->out, &n, -1);
+            continue;
+        }
+        if(d->mark[k] != d->gen)
+        {
+            d->mark[k] = d->gen;
+            d->work[n++] = k;
+        }
+        if(st->op == RX_ASSERT && st->out1 == sym)
+            regexClosure(d, st->out, &n, sym);
+    }
+    if(d->unanchored && sym < 256)
+        regexClosure(d, d->entry, &n, -1);
+
+    next = regexDfaState(d, n);
+    if(d->flushes == flushes)
+        d->next[state * re->nclasses + re->cls[sym]] = next;
+    return next;
+}
+
+// function that sets up the DFAs a thread matches a regex with
+void regexCacheInit(struct regexCache *rc, const struct regex *re)
+{
+    regexDfaInit(&rc->fwd, re, re->fwd, 0);
+    regexDfaInit(&rc->rev, re, re->rev, 1);
+}
+
+void regexCacheFree(struct regexCache *rc)
+{
+    regexDfaFree(&rc->fwd);
+    regexDfaFree(&rc->rev);
+}
+
+// function that returns the symbol before position 'q' of a line: the start symbol, a byte or the end symbol
+int regexSymbol(const char *s, int len, int q)
+{
+    return q == 0 ? RX_BOL : q == len + 1 ? RX_EOL : (unsigned char)s[q - 1];
+}
+
+// function that runs the forward DFA from position 'q', returning where the longest match ends or -1
+int regexLongest(struct regexDfa *d, const char *s, int len, int q)
+{
+    int st = regexDfaStart(d), end = d->accept[st] ? q : -1;
+
+    for(; q <= len + 1; q++)
+    {
+        st = regexDfaStep(d, st, regexSymbol(s, len, q));
+        if(d->setoff[st] == d->setoff[st + 1])
+            break;
+        if(d->accept[st])
+            end = q + 1;
+    }
+    return end;
+}
+
+/* function that returns the offset of the leftmost longest match in s[0..len),
+    with its length in '*mlen', or -1, in time linear in 'len' */
+int regexMatch(struct regexCache *rc, const char *s, int len, int *mlen)
+{
+    struct regexDfa *d = &rc->rev;
+    int st, q, start = -1, end;
+
+    /* on an empty line both events fall on the same place and hold in either
+        order, so they take turns until no assertion is left to pass */
+    if(len == 0)
+    {
+        int size;
+        d = &rc->fwd;
+        st = regexDfaStart(d);
+        do
+        {
+            size = d->setoff[st + 1] - d->setoff[st];
+            st = regexDfaStep(d, st, RX_BOL);
+            st = regexDfaStep(d, st, RX_EOL);
+        }
+        while(d->setoff[st + 1] - d->setoff[st] > size);
+        *mlen = 0;
+        return d->accept[st] ? 0 : -1;
+    }
+
+    /* the line is read as the start event, its bytes and the end event,
+        position q sits before symbol q, so byte i is symbol i + 1; running
+        the mirrored program from the end, the last place it accepts is
+        where the leftmost match starts */
+    st = regexDfaStart(d);
+    if(d->accept[st])
+        start = len + 2;
+    for(q = len + 1; q >= 0; q--)
+    {
+        st = regexDfaStep(d, st, regexSymbol(s, len, q));
+        if(d->accept[st])
+            start = q;
+    }
+    if(start < 0)
+        return -1;
+
+    // from there the program runs forward until it dies, the last accept ends the match
+    end = regexLongest(&rc->fwd, s, len, start);
+
+    start = start > 0 ? start - 1 : 0;
+    end = end > 0 ? end - 1 : 0;
+    if(start > len)
+        start = len;
+    if(end > len)
+        end = len;
+    *mlen = end - start;
+    return start;
+}
+
+
+/* background search */
+// function that returns the line holding byte 'pos', given line offsets 'off' within [lo, hi)
+int searchLineAt(const size_t *off, size_t pos, int lo, int hi)
+{
+    while(hi - lo > 1)
+    {
+        int mid = lo + (hi - lo) / 2;
+        if(off[mid] <= pos)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/* function that searches line 'line' of the mapping as it would render,
+    without loading it, and returns the render offset of the match or -1 */
+int searchMappedLine(const struct searchNeedle *nd, int line)
+{
+    erow tmp;
+    const char *m;
+    int rx;
+
+    // the row storage belongs to the UI thread, so workers render into malloc'd memory
+    tmp.chars = (char *)editorMapLine(line, &tmp.size);
+    tmp.render = malloc(editorRenderLen(tmp.chars, tmp.size) + 1);
+    tmp.rsize = editorRenderTo(tmp.chars, tmp.size, tmp.render);
+    m = searchFind(nd, tmp.render, tmp.rsize);
+    rx = m ? m - tmp.render : -1;
+    free(tmp.render);
+    return rx;
+}
+
+/* function that returns a loaded row as it renders, in 'len' bytes. A wide
+    row has no render, so a tabbed one is rendered into malloc'd memory,
+    which is then the only case where the result is neither its render nor
+    its characters */
+char *searchRowRender(erow *row, int *len)
+{
+    char *render;
+
+    if(!row->wide || !row->tabbed)
+    {
+        *len = row->rsize;
+        return row->wide ? row->chars : row->render;
+    }
+    render = malloc(editorRenderLen(row->chars, row->size) + 1);
+    *len = editorRenderTo(row->chars, row->size, render);
+    return render;
+}
+
+// function that adds a hit to a chunk
+void searchAddHit(struct searchChunk *c, int row, int rx, int len)
+{
+    if((c->nhits & (c->nhits - 1)) == 0)
+        c->hit = realloc(c->hit,
+                sizeof(struct searchHit) * (c->nhits ? c->nhits * 2 : 1));
+    c->hit[c->nhits].row = row;
+    c->hit[c->nhits].rx = rx;
+    c->hit[c->nhits++].len = len;
+}
+
+/* function that runs a regex over line 'line' of a chunk as it renders, and
+    adds the row to the hits if it matches */
+void searchRegexLine(struct searchJob *job, struct regexCache *rc,
+        struct searchChunk *c, int line)
+{
+    erow tmp;
+    int rx, mlen;
+
+    if(c->mapped)
+    {
+        tmp.chars = (char *)editorMapLine(c->first + line, &tmp.size);
+        tmp.render = NULL;
+        if(memchr(tmp.chars, '\t', tmp.size))
+        {
+            tmp.render = malloc(editorRenderLen(tmp.chars, tmp.size) + 1);
+            tmp.rsize = editorRenderTo(tmp.chars, tmp.size, tmp.render);
+        }
+        else
+        {
+            tmp.render = tmp.chars;
+            tmp.rsize = tmp.size;
+        }
+    }
+    else
+    {
+        erow *row = job->rows[c->first + line];
+        tmp.render = searchRowRender(row, &tmp.rsize);
+        // a render made for the search is freed below
+        tmp.chars = tmp.render == row->render || tmp.render == row->chars ? tmp.render : NULL;
+        if(job->re->haslit && !searchFind(&job->re->lit, tmp.render, tmp.rsize))
+        {
+            if(tmp.render != tmp.chars)
+                free(tmp.render);
+            return;
+        }
+    }
+
+    if((rx = regexMatch(rc, tmp.render, tmp.rsize, &mlen)) != -1)
+        searchAddHit(c, c->row + line, rx, mlen);
+    if(tmp.render != tmp.chars)
+        free(tmp.render);
+}
+
+/* function that finds the matching rows of a chunk, it only reads the
+    mapping, rows that are loaded already and the job, so it runs on any
+    thread while the prompt is up, 'rc' is the thread's own regex cache */
+void searchChunkRun(struct searchJob *job, struct searchChunk *c,
+        struct regexCache *rc)
+{
+    int line = 0, i;
+    const char *p;
+
+    /* a query that grew can only match rows the shorter one matched, and no
+        earlier than 'shift' bytes before where the shorter one did */
+    if(c->narrow)
+    {
+        for(i = 0; i < c->ncand && !__atomic_load_n(&job->cancel, __ATOMIC_RELAXED); i++)
+        {
+            int row = c->cand[i].row, from = c->cand[i].rx - job->shift, len, rx;
+            const char *s;
+            erow *r = NULL;
+
+            if(c->mapped)
+            {
+                s = editorMapLine(c->first + row - c->row, &len);
+                if(memchr(s, '\t', len))
+                {
+                    if((rx = searchMappedLine(&job->nd, c->first + row - c->row)) != -1)
+                        searchAddHit(c, row, rx, job->nd.len);
+                    continue;
+                }
+            }
+            else
+            {
+                r = job->rows[c->first + row - c->row];
+                s = searchRowRender(r, &len);
+            }
+            if(from < 0)
+                from = 0;
+            if(from <= len && (p = searchFind(&job->nd, s + from, len - from)))
+                searchAddHit(c, row, p - s, job->nd.len);
+            if(r && s != r->render && s != r->chars)
+                free((char *)s);
+        }
+    }
+    else if(job->re)
+    {
+        const size_t *off = c->mapped ? E.lineoff + c->first : NULL;
+        size_t end = 0;
+
+        if(c->mapped)
+            end = off[c->lines] > E.maplen ? E.maplen : off[c->lines];
+
+        /* the DFA only runs on lines holding the regex's literal, in the
+            mapping the substring scan jumps straight to them */
+        for(; line < c->lines && !__atomic_load_n(&job->cancel, __ATOMIC_RELAXED); line++)
+        {
+            if(c->mapped && job->re->haslit)
+            {
+                p = searchRegion(&job->re->lit, E.map + off[line], end - off[line], 1);
+                if(!p)
+                    break;
+                line = searchLineAt(off, p - E.map, line, c->lines);
+            }
+            searchRegexLine(job, rc, c, line);
+        }
+    }
+    else if(!c->mapped)
+    {
+        for(; line < c->lines; line++)
+        {
+            erow *row = job->rows[c->first + line];
+            int len;
+            char *s = searchRowRender(row, &len);
+            if((p = searchFind(&job->nd, s, len)))
+                searchAddHit(c, c->row + line, p - s, job->nd.len);
+            if(s != row->render && s != row->chars)
+                free(s);
+        }
+    }
+    else
+    {
+        const size_t *off = E.lineoff + c->first;
+        size_t start = off[0];
+        size_t end = off[c->lines] > E.maplen ? E.maplen : off[c->lines];
+
+        // the lines of the mapping are contiguous, so each step jumps to the next hit
+        while(line < c->lines && !__atomic_load_n(&job->cancel, __ATOMIC_RELAXED) &&
+                (p = searchRegion(&job->nd, E.map + start, end - start, 1)))
+        {
+            line = searchLineAt(off, p - E.map, line, c->lines);
+            const char *s = E.map + off[line];
+            int rx = p - s;
+
+            // tabs before the hit move it in the render, tabs themselves may match
+            if(*p == '\t' || memchr(s, '\t', p - s))
+                rx = searchMappedLine(&job->nd, c->first + line);
+            if(rx != -1)
+                searchAddHit(c, c->row + line, rx, job->nd.len);
+            start = off[++line];
+        }
+    }
+
+    // a chunk cut short by a cancel stays undone, so nothing narrows from it
+    if(!__atomic_load_n(&job->cancel, __ATOMIC_RELAXED))
+        __atomic_store_n(&c->done, 1, __ATOMIC_RELEASE);
+}
+
+// function run by every search worker, taking chunks until none are left
+void *searchWorker(void *arg)
+{
+    struct searchJob *job = arg;
+    struct regexCache rc;
+    int c;
+
+    if(job->re)
+        regexCacheInit(&rc, job->re);
+    while(!__atomic_load_n(&job->cancel, __ATOMIC_RELAXED) &&
+            (c = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->nchunks)
+    {
+        searchChunkRun(job, &job->chunk[c], &rc);
+        __atomic_fetch_add(&job->finished, 1, __ATOMIC_RELEASE);
+        if(write(job->wake[1], "", 1) == -1)
+        {
+            // the pipe is full, so the prompt is awake already
+        }
+    }
+    if(job->re)
+        regexCacheFree(&rc);
+    return NULL;
+}
+
+// function that adds a chunk of 'lines' rows starting at row 'row' to a job
+void searchAddChunk(struct searchJob *job, int row, int first, int lines, int mapped)
+{
+    struct searchChunk *c;
+
+    if((job->nchunks & (job->nchunks - 1)) == 0)
+        job->chunk = realloc(job->chunk,
+                sizeof(struct searchChunk) * (job->nchunks ? job->nchunks * 2 : 1));
+    c = &job->chunk[job->nchunks++];
+    c->row = row;
+    c->lines = lines;
+    c->first = first;
+    c->mapped = mapped;
+    c->hit = NULL;
+    c->nhits = 0;
+    c->done = 0;
+    c->narrow = 0;
+    c->cand = NULL;
+    c->ncand = 0;
+}
+
+// function that stops the workers of a search, chunks they finished stay done
+void searchCancel(struct searchJob *job)
+{
+    int i;
+
+    __atomic_store_n(&job->cancel, 1, __ATOMIC_RELAXED);
+    for(i = 0; i < job->nthreads; i++)
+        pthread_join(job->thread[i], NULL);
+    if(job->nthreads)
+    {
+        close(job->wake[0]);
+        close(job->wake[1]);
+    }
+    job->nthreads = 0;
+}
+
+// function that stops the running search and frees its results
+void editorSearchStop()
+{
+    struct searchJob *job = E.search;
+    int i;
+
+    if(!job)
+        return;
 
-    // insert character in row at cursor position
-    editorRowInsertChar(&E.row[E.cy], E.cx, c);
-    //update cursor x position
-    E.cx++;
+    searchCancel(job);
+    for(i = 0; i < job->nchunks; i++)
+    {
+        free(job->chunk[i].hit);
+        free(job->chunk[i].cand);
+    }
+    free(job->chunk);
+    free(job->rows);
+    free(job->thread);
+    searchFree(&job->nd);
+    regexFree(job->re);
+    free(job);
+    E.search = NULL;
 }
 
-//function to insert new line
-void editorInsertNewline()
+/* function that starts searching the buffer for 'query', as a regex if 'regex'
+    is set, on 'threads' workers, 0 picks one per processor, results are read
+    back with editorSearchStep */
+void editorSearchStart(const char *query, int nocase, int regex, int threads)
 {
-    // add empty row
-    if(E.cx == 0)
+    struct searchJob *job, *old = E.search;
+    struct rownode *n;
+    int at = 0, nrows = 0, i;
+    size_t bytes = 0;
+    char *grew;
+
+    job = calloc(1, sizeof(struct searchJob));
+    searchCompile(&job->nd, query, nocase);
+    job->current = -1;
+    if(regex && !(job->re = regexCompile(query, nocase)))
+        job->bad = 1;
+
+    /* when the query only grew, the chunks are kept and whatever the old query
+        found in them becomes the candidates, chunks it never finished get
+        searched in full, deleting characters starts over */
+    if(old && old->nd.len > 0 && old->nd.nocase == nocase && !regex && !old->re &&
+            !old->bad && (grew = strstr(job->nd.s, old->nd.s)))
     {
-        editorInsertRow(E.cy, "", 0);
+        searchCancel(old);
+        job->shift = grew - job->nd.s;
+        job->chunk = old->chunk;
+        job->nchunks = old->nchunks;
+        job->rows = old->rows;
+        old->chunk = NULL;
+        old->nchunks = 0;
+        old->rows = NULL;
+        for(i = 0; i < job->nchunks; i++)
+        {
+            struct searchChunk *c = &job->chunk[i];
+            free(c->cand);
+            c->narrow = c->done;
+            c->cand = c->done ? c->hit : NULL;
+            c->ncand = c->done ? c->nhits : 0;
+            if(!c->done)
+                free(c->hit);
+            c->hit = NULL;
+            c->nhits = 0;
+            c->done = 0;
+        }
     }
-    else
+    editorSearchStop();
+
+    // cut the buffer into chunks of about KILO_SEARCH_CHUNK bytes
+    for(n = job->nchunks || job->bad ? NULL : rowTreeFirst(); n; n = rowTreeNext(n))
     {
-        erow *row = &E.row[E.cy];
-        // insert new line in the middle of current row
-        editorInsertRow(E.cy + 1, &row->chars[E.cx], row->size - E.cx);
-        //update row w/ cursor y position
-        row = &E.row[E.cy];
-        // set row size
-        row->size = E.cx;
-        row->chars[row->size] = '\0';
-        editorUpdateRow(row);
-    }
-    // update cursor positions
-    E.cy++;
-    E.cx = 0;
-}
+        if(n->span)
+        {
+            int l = n->first, end = n->first + n->span;
+            while(l < end)
+            {
+                int m = searchLineAt(E.lineoff, E.lineoff[l] + KILO_SEARCH_CHUNK,
+                        l, end) + 1;
+                searchAddChunk(job, at, l, m - l, 1);
+                at += m - l;
+                l = m;
+            }
+            continue;
+        }
 
-//function to delete character
-void editorDelChar()
-{
-    if(E.cy == E.numrows)
-        return;
-    if(E.cx == 0 && E.cy == 0)
-        return;
+        /* loaded rows are searched where they are, nothing edits or frees
+            them until the prompt is done and the search stopped */
+        struct searchChunk *last = job->nchunks ? &job->chunk[job->nchunks - 1] : NULL;
+        if((nrows & (nrows - 1)) == 0)
+            job->rows = realloc(job->rows, sizeof(erow *) * (nrows ? nrows * 2 : 1));
+        job->rows[nrows] = &n->row;
+        // workers read a wide row in one piece
+        editorRowFlat(&n->row);
+        if(last && !last->mapped && bytes < KILO_SEARCH_CHUNK)
+        {
+            last->lines++;
+        }
+        else
+        {
+            searchAddChunk(job, at, nrows, 1, 0);
+            bytes = 0;
+        }
+        bytes += n->row.rsize + 1;
+        nrows++;
+        at++;
+    }
 
-    erow *row = &E.row[E.cy];
+    if(threads == 0)
+    {
+        threads = sysconf(_SC_NPROCESSORS_ONLN);
+        if(threads > KILO_SEARCH_THREADS)
+            threads = KILO_SEARCH_THREADS;
+    }
+    if(threads < 1)
+        threads = 1;
 
-    // checking cursor position
-    if(E.cx > 0)
+    /* a buffer of one chunk is searched right away, anything larger on at
+        least one worker, even with one processor, so the prompt never waits */
+    if(job->nchunks > 1 && pipe(job->wake) == 0)
     {
-        // delete character left of cursor
-        editorRowDelChar(row, E.cx - 1);
-        //reposition cursor
-        E.cx--;
+        fcntl(job->wake[0], F_SETFL, O_NONBLOCK);
+        fcntl(job->wake[1], F_SETFL, O_NONBLOCK);
+        job->thread = malloc(sizeof(pthread_t) * threads);
+        for(i = 0; i < threads; i++)
+            if(pthread_create(&job->thread[job->nthreads], NULL, searchWorker, job) == 0)
+                job->nthreads++;
     }
-    else
+    if(job->nthreads == 0)
     {
-        // get cursor to move back to previous row
-        E.cx = E.row[E.cy - 1].size;
-        //append string to previous row
-        editorRowAppendString(&E.row[E.cy - 1], row->chars, row->size);
-        //delete row
-        editorDelRow(E.cy);
-        E.cy--;
+        if(job->thread)
+        {
+            close(job->wake[0]);
+            close(job->wake[1]);
+        }
+        struct regexCache rc;
+        if(job->re)
+            regexCacheInit(&rc, job->re);
+        for(i = 0; i < job->nchunks; i++)
+            searchChunkRun(job, &job->chunk[i], &rc);
+        if(job->re)
+            regexCacheFree(&rc);
+        job->finished = job->seen = job->nchunks;
     }
+    E.search = job;
 }
 
-
-/* file I/O */
-// function to make multiple rows into a string
-char *editorRowsToString(int *buflen)
+// function that returns 1 when workers finished more chunks than the screen shows
+int editorSearchPoll()
 {
-    // variable declaration/assignment
-    int j, totlen = 0;
+    struct searchJob *job = E.search;
+    char drain[64];
 
-    // get the number of bytes for the row
-    for(j = 0; j < E.numrows; j++)
-        totlen += E.row[j].size + 1;
-    *buflen = totlen;
+    while(read(job->wake[0], drain, sizeof(drain)) > 0)
+        ;
+    int finished = __atomic_load_n(&job->finished, __ATOMIC_ACQUIRE);
+    if(finished == job->seen)
+        return 0;
+    job->seen = finished;
+    return 1;
+}
 
-    // variable declaration/assignment
-    char *buf = malloc(totlen);
-    char *p = buf;
+// function that returns the chunk of the running search holding row 'row'
+int searchChunkOf(int row)
+{
+    struct searchJob *job = E.search;
+    int lo = 0, hi = job->nchunks;
 
-    // get the rows into one string
-    for(j = 0; j < E.numrows; j++)
+    while(hi - lo > 1)
     {
-        memcpy(p, E.row[j].chars, E.row[j].size);
-        p += E.row[j].size;
-        *p = '\n';
-        p++;
+        int mid = lo + (hi - lo) / 2;
+        if(job->chunk[mid].row <= row)
+            lo = mid;
+        else
+            hi = mid;
     }
-    return buf;
+    return lo;
 }
 
-//function to open editor with file
-void editorOpen(char *filename)
+/* function that returns the first matching row in rows lo..hi-1, going up when
+    'dir' is -1, with its match in '*hit', -1 if there is none, or -2 if the
+    workers have not got that far yet */
+int searchHits(int lo, int hi, int dir, struct searchHit *hit)
 {
-    // free filename
-    free(E.filename);
-    E.filename = strdup(filename);
+    struct searchJob *job = E.search;
+    int c;
 
-    editorSelectSyntaxHighlight();
+    if(lo >= hi || job->nchunks == 0)
+        return -1;
 
-    // open file in read mode
-    FILE *fp = fopen(filename, "r");
+    for(c = searchChunkOf(dir > 0 ? lo : hi - 1); c >= 0 && c < job->nchunks; c += dir)
+    {
+        struct searchChunk *ch = &job->chunk[c];
+        if(dir > 0 ? ch->row >= hi : ch->row + ch->lines <= lo)
+            break;
+        if(!__atomic_load_n(&ch->done, __ATOMIC_ACQUIRE))
+            return -2;
 
-    // if file not open, then print error 
-    if(!fp)
-        die("fopen");
+        // first hit at or after 'lo', or the one before the first at 'hi'
+        int key = dir > 0 ? lo : hi, a = 0, b = ch->nhits;
+        while(a < b)
+        {
+            int mid = a + (b - a) / 2;
+            if(ch->hit[mid].row < key)
+                a = mid + 1;
+            else
+                b = mid;
+        }
+        if(dir < 0)
+            a--;
+        if(a >= 0 && a < ch->nhits && ch->hit[a].row >= lo && ch->hit[a].row < hi)
+        {
+            *hit = ch->hit[a];
+            return hit->row;
+        }
+    }
+    return -1;
+}
 
-    //variable declaration/assignment
-    char *line = NULL;
-    size_t linecap = 0;
-    ssize_t linelen;
+/* function that returns the match after (dir 1) or before (dir -1) row 'from',
+    wrapping around the buffer, like searchHits */
+int editorSearchStep(int from, int dir, struct searchHit *hit)
+{
+    int row;
 
-    while((linelen = getline(&line, &linecap, fp)) != -1)
+    if(dir > 0)
     {
-        while(linelen > 0 && (line[linelen - 1] == '\n' ||
-                line[linelen - 1] == '\r'))
-            linelen--;
-        editorInsertRow(E.numrows, line, linelen);
+        if((row = searchHits(from + 1, E.numrows, 1, hit)) == -1)
+            row = searchHits(0, from + 1, 1, hit);
     }
-    //free line
-    free(line);
-    //close file
-    fclose(fp);
-    //reset buffer
-    E.dirty = 0;
+    else
+    {
+        if((row = searchHits(0, from, -1, hit)) == -1)
+            row = searchHits(from, E.numrows, -1, hit);
+    }
+    return row;
 }
 
-//function to save file
-void editorSave()
+/* function that returns how many rows of the running search match so far,
+    and the rank of row 'row' among them in '*rank', or 0 if not known yet */
+int editorSearchCount(int row, int *rank)
 {
-    // check if file name exists
-    if(E.filename == NULL)
-    {
-        // get file name from user for saving
-        E.filename = editorPrompt("Save as: %s (ESC to cancel)", NULL);
-        //abort save if file name not entered
-        if(E.filename == NULL)
-        {
-            editorSetStatusMessage("Save aborted");
-            return;
-        }
-        editorSelectSyntaxHighlight();
-    }
+    struct searchJob *job = E.search;
+    int total = 0, prefix = 1, c;
 
-    //variable declaration/assignment
-    int len, fd = open(E.filename, O_RDWR | O_CREAT, 0644);
-    char *buf = editorRowsToString(&len);
-    
-    //check if fd returns success or failure
-    if(fd != -1)
+    *rank = 0;
+    for(c = 0; c < job->nchunks; c++)
     {
-        //check if ftruncate() returns an error or not
-        if(ftruncate(fd, len) != -1)
+        struct searchChunk *ch = &job->chunk[c];
+        if(!__atomic_load_n(&ch->done, __ATOMIC_ACQUIRE))
         {
-            //inform user of how much bytes were saved to disk when no errors return
-            if(write(fd, buf, len) == len)
-            {
-                //close fd and free buffer
-                close(fd);
-                free(buf);
-                E.dirty = 0;
-                editorSetStatusMessage("%d bytes written to disk", len);
-                return;
-            }
+            prefix = 0;
+            continue;
         }
-        //close fd
-        close(fd);
+        if(prefix && row >= ch->row && row < ch->row + ch->lines)
+            for(int i = 0; i < ch->nhits; i++)
+                if(ch->hit[i].row == row)
+                    *rank = total + i + 1;
+        total += ch->nhits;
     }
-    //free buffer
-    free(buf);
-    //print error to user if error returns
-    editorSetStatusMessage("Cannot save! I/O error: %s", strerror(errno));
+    return total;
 }
 
 
@@ -908,17 +5966,31 @@ void editorFindCallback(char *query, int key)
 
     static int saved_hl_line;
     static char *saved_hl = NULL;
+    static int saved_wide = 0;
+
+    // results coming in only matter while a step is waiting for them
+    if(key == SEARCH_UPDATE && !E.search->pending)
+        return;
 
     if(saved_hl)
     {
-        memcpy(E.row[saved_hl_line].hl, saved_hl, E.row[saved_hl_line].rsize);
+        erow *saved = editorRowAt(saved_hl_line);
+        memcpy(saved->hl, saved_hl, saved->rsize);
         free(saved_hl);
         saved_hl = NULL;
     }
+    if(saved_wide)
+    {
+        erow *saved = editorRowAt(saved_hl_line);
+        if(saved->wide)
+            saved->wide->match_len = 0;
+        saved_wide = 0;
+    }
 
     // search forward or backwards depending on what key the user presses
     if(key == '\r' || key == '\x1b')
     {
+        editorSearchStop();
         last_match = -1;
         direction = 1;
         return;
@@ -933,50 +6005,53 @@ void editorFindCallback(char *query, int key)
         //if -1, search previous
         direction = -1;
     }
-    else
+    else if(key != SEARCH_UPDATE)
     {
+        // the query changed, so whatever is still running is thrown away
         last_match = -1;
         direction = 1;
+        if(key == CTRL_KEY('t'))
+            E.search_nocase = !E.search_nocase;
+        if(key == CTRL_KEY('r'))
+            E.search_regex = !E.search_regex;
+        editorSearchStart(query, E.search_nocase, E.search_regex, 0);
     }
 
     if(last_match == -1)
         direction = 1;
 
-    int current = last_match;
-
-    //search through the rows
-    for(int i = 0; i < E.numrows; i++)
+    /* take the match after the last one, wrapping around, if the workers
+        have not reached it yet the step is retried as results come in */
+    struct searchHit hit;
+    int current = editorSearchStep(last_match, direction, &hit);
+    E.search->pending = current == -2;
+    if(current >= 0)
     {
-        current += direction;
-
-        //searching backwards and forwards for each find
-        if(current == -1)
-        {
-            current = E.numrows - 1;
-        }
-        else if(current == E.numrows)
-        {
-            current = 0;
-        }
-
-        erow *row = &E.row[current];
-        char *match = strstr(row->render, query);
-        if(match)
+        erow *row = editorRowAt(current);
+        // the match is marked in hl, so nothing from the workers may land on it
+        editorSyntaxEnsure(row, editorSyntaxStateAt(current));
+        editorHighlightForget(row);
+        //set lastmatch equal to current find
+        last_match = current;
+        E.search->current = current;
+        //set cursor y position on current
+        E.cy = current;
+        //set cursor x position to character index
+        E.cx = editorRowRxToCx(row, hit.rx);
+        E.rowoff = E.numrows;
+        //highlighting current find
+        saved_hl_line = current;
+        // a wide row draws the match over the window it renders
+        if(row->wide)
         {
-            //set lastmatch equal to current find
-            last_match = current;
-            //set cursor y position on current
-            E.cy = current;
-            //set cursor x position to character index
-            E.cx = editorRowRxToCx(row, match - row->render);
-            E.rowoff = E.numrows;
-            //highlighting current find
-            saved_hl_line = current;
-            saved_hl = malloc(row->rsize);
-            memcpy(saved_hl, row->hl, row->rsize);
-            memset(&row->hl[match - row->render], HL_MATCH, strlen(query));
-            break;
+            row->wide->match_rx = hit.rx;
+            row->wide->match_len = hit.len;
+            saved_wide = 1;
+            return;
         }
+        saved_hl = malloc(row->rsize);
+        memcpy(saved_hl, row->hl, row->rsize);
+        memset(&row->hl[hit.rx], HL_MATCH, hit.len);
     }
 }
 
@@ -988,7 +6063,7 @@ void editorFind()
             saved_rowoff = E.rowoff;
 
     //prompt user on how to use search and call function that performs the search
-    char *query = editorPrompt("Search: %s (Use ESC/Arrows/Enter)",
+    char *query = editorPrompt("Search: %s (Use ESC/Arrows/Enter, Ctrl-T: case, Ctrl-R: regex)",
             editorFindCallback);
     
     if(query)
@@ -1007,26 +6082,30 @@ void editorFind()
 
 
 /* append buffer */
-struct abuf
-{
-    char *b;
-    int len;
-};
-
-#define ABUF_INIT {NULL, 0}
+#define ABUF_INIT {NULL, 0, 0}
 
 //function to append the buffer
 void abAppend(struct abuf *ab, const char *s, int len)
 {
-    // reallocate space
-    char *new = realloc(ab->b, ab->len + len);
+    E.stats.appends++;
+    E.stats.appended += len;
 
-    if(new == NULL)
-        return;
+    // grow the capacity geometrically so appending is amortized O(1)
+    if(ab->len + len > ab->cap)
+    {
+        int cap = ab->cap ? ab->cap : 4096;
+        while(cap < ab->len + len)
+            cap *= 2;
+
+        char *new = realloc(ab->b, cap);
+        if(new == NULL)
+            return;
+        ab->b = new;
+        ab->cap = cap;
+    }
 
     //append string 's' to buffer in memory
-    memcpy(&new[ab->len], s, len);
-    ab->b = new;
+    memcpy(&ab->b[ab->len], s, len);
     ab->len += len;
 }
 
@@ -1038,43 +6117,219 @@ void abFree(struct abuf *ab)
 }
 
 
+/* screen frame */
+// function that resizes a frame, its contents become unknown
+void frameResize(struct screenFrame *f, int rows, int cols)
+{
+    f->rows = rows;
+    f->cols = cols;
+    f->glyph = realloc(f->glyph, rows * cols);
+    f->attr = realloc(f->attr, rows * cols);
+    f->valid = 0;
+}
+
+// function that blanks one row of a frame
+void frameClearRow(struct screenFrame *f, int y, unsigned char attr)
+{
+    memset(&f->glyph[y * f->cols], ' ', f->cols);
+    memset(&f->attr[y * f->cols], attr, f->cols);
+}
+
+// function that writes 'len' characters into a frame row, clipped to its width
+void framePut(struct screenFrame *f, int y, int x, const char *s, int len,
+        unsigned char attr)
+{
+    if(x + len > f->cols)
+        len = f->cols - x;
+    if(len <= 0)
+        return;
+    memcpy(&f->glyph[y * f->cols + x], s, len);
+    memset(&f->attr[y * f->cols + x], attr, len);
+}
+
+/* function that moves rows [0, bottom) of a frame up by 'n' rows (down if 'n'
+    is negative) and blanks the rows that scroll in, like the terminal does */
+void frameScroll(struct screenFrame *f, int bottom, int n)
+{
+    int keep = bottom - (n > 0 ? n : -n), y;
+    int from = n > 0 ? n : 0, to = n > 0 ? 0 : -n;
+
+    memmove(&f->glyph[to * f->cols], &f->glyph[from * f->cols], keep * f->cols);
+    memmove(&f->attr[to * f->cols], &f->attr[from * f->cols], keep * f->cols);
+    for(y = (n > 0 ? keep : 0); y < (n > 0 ? bottom : -n); y++)
+        frameClearRow(f, y, ATTR_DEFAULT);
+}
+
+// function that appends the escape sequence that switches to 'attr'
+void frameSetAttr(struct abuf *ab, unsigned char attr)
+{
+    char buf[16];
+    int len = 0;
+
+    // reset first so reverse video from the previous attribute goes away
+    buf[len++] = '\x1b';
+    buf[len++] = '[';
+    buf[len++] = '0';
+    if(attr & ATTR_REVERSE)
+    {
+        memcpy(&buf[len], ";7", 2);
+        len += 2;
+    }
+    if((attr & ~ATTR_REVERSE) != ATTR_DEFAULT)
+        len += sprintf(&buf[len], ";%d", attr & ~ATTR_REVERSE);
+    buf[len++] = 'm';
+    abAppend(ab, buf, len);
+}
+
+/* This function compares a new frame with what the terminal shows and
+    appends escape sequences that repaint only the cells that changed, then
+    records the new frame as what the terminal shows.
+*/
+void frameDiff(struct screenFrame *f, struct screenFrame *old, struct abuf *ab)
+{
+    int cur = -1; // attribute the terminal is using, -1 if unknown
+    char buf[32];
+
+    for(int y = 0; y < f->rows; y++)
+    {
+        char *g = &f->glyph[y * f->cols], *og = &old->glyph[y * f->cols];
+        unsigned char *a = &f->attr[y * f->cols], *oa = &old->attr[y * f->cols];
+        int x = 0, blank = f->cols;
+
+        // cells from 'blank' on are empty and can be cleared with one sequence
+        while(blank > 0 && g[blank - 1] == ' ' && a[blank - 1] == ATTR_DEFAULT)
+            blank--;
+
+        while(x < f->cols)
+        {
+            if(old->valid && g[x] == og[x] && a[x] == oa[x])
+            {
+                x++;
+                continue;
+            }
+
+            // grow the span over short runs of unchanged cells
+            int start = x, end = x + 1, j;
+            for(j = end; j < f->cols && j - end < KILO_DIFF_GAP; j++)
+                if(!old->valid || g[j] != og[j] || a[j] != oa[j])
+                    end = j + 1;
+
+            int len = snprintf(buf, sizeof(buf), "\x1b[%d;%dH", y + 1, start + 1);
+            abAppend(ab, buf, len);
+
+            // each run of cells with the same attribute is one copy
+            for(j = start; j < end && j < blank; )
+            {
+                int k = j + 1;
+                while(k < end && k < blank && a[k] == a[j])
+                    k++;
+                if(a[j] != cur)
+                {
+                    frameSetAttr(ab, a[j]);
+                    cur = a[j];
+                }
+                abAppend(ab, &g[j], k - j);
+                j = k;
+            }
+            if(end > blank)
+            {
+                if(cur != ATTR_DEFAULT)
+                {
+                    frameSetAttr(ab, ATTR_DEFAULT);
+                    cur = ATTR_DEFAULT;
+                }
+                abAppend(ab, "\x1b[K", 3);
+                end = f->cols;
+            }
+            x = end;
+        }
+
+        memcpy(og, g, f->cols);
+        memcpy(oa, a, f->cols);
+    }
+    old->valid = 1;
+
+    if(cur != ATTR_DEFAULT)
+        frameSetAttr(ab, ATTR_DEFAULT);
+}
+
+
 /* output */
 /* This function creates spaces for a status bar at the bottom of the text 
     editor, and displays numerous different data for the user to see while 
     editing text.
 */
-void editorDrawStatusBar(struct abuf *ab)
+// function that prints 'n' with commas between groups of three digits
+void editorFormatCount(char *buf, size_t size, int n)
+{
+    char digits[16];
+    int len = snprintf(digits, sizeof(digits), "%d", n), j = 0;
+
+    for(int i = 0; i < len && j + 2 < (int)size; i++)
+    {
+        if(i > 0 && (len - i) % 3 == 0)
+            buf[j++] = ',';
+        buf[j++] = digits[i];
+    }
+    buf[j] = '\0';
+}
+
+void editorDrawStatusBar(struct screenFrame *f)
 {
-    abAppend(ab, "\x1b[7m", 4);
+    int y = E.screenrows;
+    frameClearRow(f, y, ATTR_DEFAULT | ATTR_REVERSE);
     //variable declaration/assignment
     char status[80], rstatus[80];
-    int len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
-            E.filename ? E.filename : "[No Name]", E.numrows,
-            E.dirty ? "(modified)" : "");
-    int rlen = snprintf(rstatus, sizeof(rstatus), "%s | %d/%d",
+    int len;
+    if(E.stats_shown)
+    {
+        // the counters take the place of the file name
+        struct editorStats *st = &E.stats;
+        char bytes[16];
+        editorFormatCount(bytes, sizeof(bytes), st->frame_bytes);
+        len = snprintf(status, sizeof(status), "frame %.2f ms %s B | hl %ld | "
+                "reads %ld | rss %.1f MB", st->frame_secs * 1e3, bytes,
+                st->highlights - st->mark_highlights, st->key_reads, st->rss / (1024.0 * 1024.0));
+    }
+    else
+        len = snprintf(status, sizeof(status), "%.20s - %d lines %s",
+                E.filename ? E.filename : "[No Name]", E.numrows,
+                E.dirty ? "(modified)" : "");
+    char found[56] = "";
+    if(E.search)
+    {
+        // match count of the search behind the prompt, '...' while it runs
+        int rank, total = editorSearchCount(E.search->current, &rank);
+        int running = E.search->finished < E.search->nchunks;
+        char n[16], m[16];
+        editorFormatCount(n, sizeof(n), rank);
+        editorFormatCount(m, sizeof(m), total);
+        const char *mode = E.search->re ? "regex " : "";
+        if(E.search->bad)
+            snprintf(found, sizeof(found), "bad regex | ");
+        else if(rank)
+            snprintf(found, sizeof(found), "%smatch %s of %s%s | ", mode, n, m,
+                    running ? "..." : "");
+        else
+            snprintf(found, sizeof(found), "%s%s match%s%s | ", mode,
+                    total ? m : "no", total == 1 ? "" : "es", running ? "..." : "");
+    }
+    char saving[24] = "";
+    if(E.save)
+        snprintf(saving, sizeof(saving), "saving %d%% | ", (int)(E.save->size ?
+                __atomic_load_n(&E.save->written, __ATOMIC_RELAXED) * 100 / E.save->size : 0));
+    int rlen = snprintf(rstatus, sizeof(rstatus), "%s%s%s | %d/%d", saving, found,
             E.syntax ? E.syntax->filetype : "no ft", E.cy + 1, E.numrows);
 
     if(len > E.screencols)
         len = E.screencols;
 
-    abAppend(ab, status, len);
+    framePut(f, y, 0, status, len, ATTR_DEFAULT | ATTR_REVERSE);
 
-    while(len < E.screencols)
-    {
-        if(E.screencols - len == rlen)
-        {
-            abAppend(ab, rstatus, rlen);
-            break;
-        }
-        else
-        {
-            abAppend(ab, " ", 1);
-            len++;
-        }
-    }
-    
-    abAppend(ab, "\x1b[m", 3);
-    abAppend(ab, "\r\n", 2);
+    // the right part only shows when it fits after the left one
+    if(len + rlen <= E.screencols)
+        framePut(f, y, E.screencols - rlen, rstatus, rlen,
+                ATTR_DEFAULT | ATTR_REVERSE);
 }
 
 /* This function checks for see if the cursor is within the window for 
@@ -1084,7 +6339,7 @@ void editorScroll()
 {
     E.rx = 0;
     if(E.cy < E.numrows)
-        E.rx = editorRowCxToRx(&E.row[E.cy], E.cx);
+        E.rx = editorRowCxToRx(editorRowAt(E.cy), E.cx);
 
     if(E.cy < E.rowoff)
         E.rowoff = E.cy;
@@ -1103,11 +6358,30 @@ void editorScroll()
     drawing each row o the buffer of the text that is being edited. It also
     draws the number of rows required to fill the window size.
 */
-void editorDrawRows(struct abuf *ab)
+void editorDrawRows(struct screenFrame *f)
 {
-    for(int y = 0; y < E.screenrows; y++)
+    editorHighlightUnseen();
+    erow *row = editorRowAt(E.rowoff);
+    /* only the rows on screen are highlighted, starting from the top one. The
+        state is -1 below a row still with the workers, and those rows wait */
+    int in_comment = editorSyntaxStateAt(E.rowoff);
+    // rows whose highlighting is still with the workers are drawn with this
+    static unsigned char *plain = NULL;
+    static int plaincap = 0;
+
+    if(plaincap < E.screencols)
+    {
+        plaincap = E.screencols;
+        plain = realloc(plain, plaincap);
+        memset(plain, HL_NORMAL, plaincap);
+    }
+    if(E.hlpool)
+        E.hlpool->frame++;
+
+    for(int y = 0; y < E.screenrows; y++, row = row ? editorRowNext(row) : NULL)
     {
         int filerow = y + E.rowoff;
+        frameClearRow(f, y, ATTR_DEFAULT);
         if(filerow >= E.numrows)
         {
             if(E.numrows == 0 && y == E.screenrows / 3)
@@ -1122,109 +6396,134 @@ void editorDrawRows(struct abuf *ab)
                 int padding = (E.screencols - welcomelen) / 2;
                 if(padding)
                 {
-                    abAppend(ab, "~", 1);
-                    padding--;
-                }
-                while(padding--)
-                {
-                    abAppend(ab, " ", 1);
+                    framePut(f, y, 0, "~", 1, ATTR_DEFAULT);
                 }
-                abAppend(ab, welcome, welcomelen);
+                framePut(f, y, padding, welcome, welcomelen, ATTR_DEFAULT);
             }
             else
             {
-                abAppend(ab, "~", 1);
+                framePut(f, y, 0, "~", 1, ATTR_DEFAULT);
             }
         }
         else
         {
-            int j, len = E.row[filerow].rsize - E.coloff;
+            int j, len = row->rsize - E.coloff;
             int current_color = -1;
+            char *c;
+            unsigned char *hl;
+            int ready = in_comment != -1 && editorSyntaxRequest(row, in_comment);
+            in_comment = ready ? row->hl_open_comment : -1;
             if(len < 0)
                 len = 0;
             if(len > E.screencols)
                 len = E.screencols;
 
-            char *c = &E.row[filerow].render[E.coloff];
-            unsigned char *hl = &E.row[filerow].hl[E.coloff];
+            // only the part of a wide row on screen is rendered
+            if(row->wide)
+            {
+                len = editorRowWindow(row, E.coloff, E.screencols, &c, &hl);
+                if(!ready)
+                    hl = plain;
+            }
+            else
+            {
+                c = &row->render[E.coloff];
+                hl = ready ? &row->hl[E.coloff] : plain;
+            }
 
-            for(j = 0; j < len; j++)
+            for(j = 0; j < len; )
             {
                 if(iscntrl(c[j]))
                 {
+                    // control characters show reversed in the current color
                     char sym = (c[j] <= 26) ? '@' + c[j] : '?';
-                    abAppend(ab, "\x1b[7m", 4);
-                    abAppend(ab, &sym, 1);
-                    abAppend(ab, "\x1b[m", 3);
-                    if(current_color != -1)
-                    {
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", current_color);
-                        abAppend(ab, buf, clen);
-                    }
+                    framePut(f, y, j, &sym, 1, ATTR_REVERSE |
+                            (current_color != -1 ? current_color : ATTR_DEFAULT));
+                    j++;
+                    continue;
                 }
-                else if(hl[j] == HL_NORMAL)
+
+                // a run of characters with the same highlight is copied at once
+                int k = j + 1;
+                while(k < len && hl[k] == hl[j] && !iscntrl(c[k]))
+                    k++;
+                if(hl[j] == HL_NORMAL)
                 {
-                    if(current_color != -1)
-                    {
-                        abAppend(ab, "\x1b[39m", 5);
-                        current_color = -1;
-                    }
-                    abAppend(ab, &c[j], 1);
+                    current_color = -1;
+                    framePut(f, y, j, &c[j], k - j, ATTR_DEFAULT);
                 }
                 else
                 {
-                    int color = editorSyntaxToColor(hl[j]);
-                    if(color != current_color)
-                    {
-                        current_color = color;
-                        char buf[16];
-                        int clen = snprintf(buf, sizeof(buf), "\x1b[%dm", color);
-                        abAppend(ab, buf, clen);
-                    }
-                    abAppend(ab, &c[j], 1);
+                    current_color = editorSyntaxToColor(hl[j]);
+                    framePut(f, y, j, &c[j], k - j, current_color);
                 }
+                j = k;
             }
-            abAppend(ab, "\x1b[39m", 5);
         }
-
-        abAppend(ab, "\x1b[K", 3);
-        abAppend(ab, "\r\n", 2);
     }
+
+    // highlight a few rows ahead so scrolling down finds them ready
+    for(int y = 0; y < KILO_HL_LOOKAHEAD && row && in_comment != -1; y++, row = editorRowNext(row))
+        in_comment = editorSyntaxRequest(row, in_comment) ? row->hl_open_comment : -1;
+    editorHighlightPrune();
 }
 
 /* This function displays a message in the status bar, but only does so
     if the message is less than 5 seconds old and if it fits within the width
     of the message bar.
 */
-void editorDrawMessageBar(struct abuf *ab)
+void editorDrawMessageBar(struct screenFrame *f)
 {
-    abAppend(ab, "\x1b[K", 3);
+    frameClearRow(f, E.screenrows + 1, ATTR_DEFAULT);
     int msglen = strlen(E.statusmsg);
     
     if(msglen > E.screencols)
         msglen = E.screencols;
     if(msglen && time(NULL) - E.statusmsg_time < 5)
-        abAppend(ab, E.statusmsg, msglen);
+        framePut(f, E.screenrows + 1, 0, E.statusmsg, msglen, ATTR_DEFAULT);
 }
 
-/* This function is designed to clear the users screen and reposition the
-    cursor to where it was before. 
+/* This function draws the next frame and updates the parts of the screen
+    that changed since the last one, then repositions the cursor.
 */
 void editorRefreshScreen()
 {
+    double start = editorNow();
+
     editorScroll();
 
-    struct abuf ab = ABUF_INIT;
+    // reuse last frame's output buffer so it does not grow from scratch
+    struct abuf ab = E.out;
     char buf[32];
 
+    ab.len = 0;
+
+    // a new window size means the terminal has to be repainted from scratch
+    if(E.frame.rows != E.screenrows + 2 || E.frame.cols != E.screencols)
+    {
+        frameResize(&E.frame, E.screenrows + 2, E.screencols);
+        frameResize(&E.shadow, E.screenrows + 2, E.screencols);
+    }
+
     // hides cursor
     abAppend(&ab, "\x1b[?25l", 6);
-    abAppend(&ab, "\x1b[H", 3);
 
-    editorDrawRows(&ab);
-    editorDrawStatusBar(&ab);
-    editorDrawMessageBar(&ab);
+    editorDrawRows(&E.frame);
+    editorDrawStatusBar(&E.frame);
+    editorDrawMessageBar(&E.frame);
+
+    /* when the view moved by less than a screen, let the terminal scroll the
+        text area so only the rows that came into view are sent */
+    int d = E.rowoff - E.shadow_rowoff;
+    if(E.shadow.valid && d != 0 && abs(d) < E.screenrows)
+    {
+        int len = snprintf(buf, sizeof(buf), "\x1b[m\x1b[1;%dr\x1b[%d%c\x1b[r",
+                E.screenrows, abs(d), d > 0 ? 'S' : 'T');
+        abAppend(&ab, buf, len);
+        frameScroll(&E.shadow, E.screenrows, d);
+    }
+    E.shadow_rowoff = E.rowoff;
+    frameDiff(&E.frame, &E.shadow, &ab);
 
     snprintf(buf, sizeof(buf), "\x1b[%d;%dH", (E.cy - E.rowoff) + 1, 
             (E.rx - E.coloff) + 1);
@@ -1232,8 +6531,24 @@ void editorRefreshScreen()
 
     abAppend(&ab, "\x1b[?25h", 6);
 
-    write(STDOUT_FILENO, ab.b, ab.len);
-    abFree(&ab);
+    struct editorStats *st = &E.stats;
+    st->frame_secs = editorNow() - start;
+    st->frame_total += st->frame_secs;
+    if(st->frame_secs > st->frame_max)
+        st->frame_max = st->frame_secs;
+    st->frame_bytes = ab.len;
+    st->frames++;
+    st->written += ab.len;
+
+    // a replay's terminal is only there to count what it would be sent
+    if(E.replay)
+    {
+        E.replay->frames++;
+        E.replay->bytes += ab.len;
+    }
+    else
+        write(STDOUT_FILENO, ab.b, ab.len);
+    E.out = ab;
 }
 
 /* This function sets a status message for the user at the bottom of the 
@@ -1268,7 +6583,27 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int))
 
         int c = editorReadKey();
 
-        if(c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE)
+        // a save moving on only needs the status bar redrawn
+        if(c == SCREEN_UPDATE)
+            continue;
+        if(c == PASTE_KEY)
+        {
+            // a paste adds its printable characters to the query at once
+            for(int i = 0; i < E.paste.len; i++)
+            {
+                unsigned char ch = E.paste.b[i];
+                if(iscntrl(ch) || ch >= 128)
+                    continue;
+                if(buflen == bufsize - 1)
+                {
+                    bufsize *= 2;
+                    buf = realloc(buf, bufsize);
+                }
+                buf[buflen++] = ch;
+            }
+            buf[buflen] = '\0';
+        }
+        else if(c == DEL_KEY || c == CTRL_KEY('h') || c == BACKSPACE)
         {
             if(buflen != 0)
                 buf[--buflen] = '\0';
@@ -1312,7 +6647,7 @@ char *editorPrompt(char *prompt, void (*callback)(char *, int))
 */
 void editorMoveCursor(int key)
 {
-    erow *row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    erow *row = editorRowAt(E.cy);
 
     switch(key)
     {
@@ -1324,7 +6659,7 @@ void editorMoveCursor(int key)
             else if(E.cy > 0)
             {
                 E.cy--;
-                E.cx = E.row[E.cy].size;
+                E.cx = editorRowAt(E.cy)->size;
             }
             break;
         case ARROW_RIGHT:
@@ -1352,7 +6687,7 @@ void editorMoveCursor(int key)
             break;
     }
 
-    row = (E.cy >= E.numrows) ? NULL : &E.row[E.cy];
+    row = editorRowAt(E.cy);
     int rowlen = row ? row->size : 0;
     if(E.cx > rowlen)
     {
@@ -1374,7 +6709,13 @@ void editorProcessKeypress()
             editorInsertNewline();
             break;
 
+        case SCREEN_UPDATE:
+            return;
+
         case CTRL_KEY('q'):
+            // a save in the background has to land before the editor goes
+            while(E.save)
+                editorSaveFinish();
             if(E.dirty && quit_times > 0)
             {
                 editorSetStatusMessage("WARNING!!! File has unsaved changes. "
@@ -1382,8 +6723,12 @@ void editorProcessKeypress()
                 quit_times--;
                 return;
             }
-            write(STDOUT_FILENO, "\x1b[2J", 4);
-            write(STDOUT_FILENO, "\x1b[H", 3);
+            // a replayed session has no screen of its own to clear
+            if(!E.replay)
+            {
+                write(STDOUT_FILENO, "\x1b[2J", 4);
+                write(STDOUT_FILENO, "\x1b[H", 3);
+            }
             exit(0);
             break;
 
@@ -1391,18 +6736,32 @@ void editorProcessKeypress()
             editorSave();
             break;
 
+        case PASTE_KEY:
+            editorInsertText(E.paste.b, E.paste.len);
+            break;
+
         case HOME_KEY:
             E.cx = 0;
             break;
         case END_KEY:
             if(E.cy < E.numrows)
-                E.cx = E.row[E.cy].size;
+                E.cx = editorRowAt(E.cy)->size;
             break;
 
         case CTRL_KEY('f'):
             editorFind();
             break;
 
+        case CTRL_KEY('g'):
+            // the counters stay in the status bar until it is pressed again
+            E.stats_shown = !E.stats_shown;
+            if(E.stats_shown)
+            {
+                E.stats.rss = editorRss();
+                rowStoreStats();
+            }
+            break;
+
         case BACKSPACE: case CTRL_KEY('h'): case DEL_KEY:
             if(c == DEL_KEY)
                 editorMoveCursor(ARROW_RIGHT);
@@ -1452,35 +6811,89 @@ void initEditor()
     E.numrows = 0;
     E.rowoff = 0;
     E.coloff = 0;
-    E.row = NULL;
+    E.rows = NULL;
     E.dirty = 0;
     E.filename = NULL;
+    E.map = NULL;
+    E.maplen = 0;
+    E.lineoff = NULL;
     E.statusmsg[0] = '\0';
     E.statusmsg_time = 0;
     E.syntax = NULL;
+    E.hl_gen = 1;
+    E.hlcp = NULL;
+    E.hlcp_len = 0;
+    E.hlcp_cap = 0;
+    E.hlcp_stale = 0;
+    E.hlcp_damage = -1;
+    E.hlcp_want = 0;
+    E.frame.glyph = E.shadow.glyph = NULL;
+    E.frame.attr = E.shadow.attr = NULL;
+    E.frame.rows = E.shadow.rows = 0;
+    E.frame.cols = E.shadow.cols = 0;
+    E.frame.valid = E.shadow.valid = 0;
+    E.shadow_rowoff = 0;
+    E.out.b = NULL;
+    E.out.len = E.out.cap = 0;
+    E.search_nocase = 0;
+    E.search_regex = 0;
+    E.search = NULL;
+    E.save = NULL;
+    E.save_gen = 0;
+    E.inpos = E.inlen = 0;
+    E.paste.b = NULL;
+    E.paste.len = E.paste.cap = 0;
+    E.mapfd = -1;
+    E.sigfd = E.timerfd = -1;
+    E.timer_at = E.autosave_at = 0;
+    E.recordfd = -1;
+    memset(&E.stats, 0, sizeof(E.stats));
+    E.stats_shown = 0;
+    E.statsfd = -1;
+    E.row_version = 0;
+    E.watchfd = E.watchwd = -1;
+    E.watchname = NULL;
+    E.disk_nl = 1;
+    E.watch_pending = 0;
 
     if(getWindowSize(&E.screenrows, &E.screencols) == -1)
         die("getWindowSize");
     E.screenrows -= 2;
 }
 
+#ifndef KILO_NO_MAIN
 // main function - where the program starts
 int main(int argc, char *argv[])
 {
     enableRawMode();
     initEditor();
+    editorInitEvents();
+    // KILO_RECORD names a file to keep the keys of the session in, for bench/replay
+    char *record = getenv("KILO_RECORD");
+    if(record && (E.recordfd = open(record, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+        die("open");
+    // KILO_STATS names a file the counters are written to on exit
+    char *stats = getenv("KILO_STATS");
+    if(stats && (E.statsfd = open(stats, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1)
+        die("open");
+    atexit(editorStatsDump);
     if(argc >= 2)
         editorOpen(argv[1]);
 
     // default status message displayed in the status bar
     editorSetStatusMessage("HELP: Ctrl-S = save | Ctrl-Q = quit | "
-            "Ctrl-F = find");
+            "Ctrl-F = find | Ctrl-G = stats");
 
     while(1)
     {
-        editorRefreshScreen();
+        // keys already waiting are handled before the next frame is drawn
+        if(editorInputPending())
+            editorScroll();
+        else
+            editorRefreshScreen();
         editorProcessKeypress();
     }
     
     return 0;
-}
\ No newline at end of file
+}
+#endif
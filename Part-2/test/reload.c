@@ -0,0 +1,388 @@
+/* Tests for a mapped file another program writes while it is open. The
+    file is made large enough to be opened lazily, then a child process
+    truncates it or rewrites part of it in place. In a modified buffer rows
+    that were never loaded have to read as the file was opened, without a
+    SIGBUS, and it has to save as the buffer, not as a mix of old and new
+    lines. An unmodified buffer keeps the rows it loaded, is opened again
+    and matches the new file.
+    A file a writer already has open is mapped without a lease, and cutting
+    it short must not kill the editor either. A small file that grows or
+    has lines in the middle rewritten only has those rows replaced, with
+    the cursor kept on the row it was on.
+
+    usage: test/reload [dir]
+*/
+#define KILO_NO_MAIN
+#include "../kilo.c"
+#include <sys/wait.h>
+
+
+/* helpers */
+int test_failed; // checks that failed so far
+
+// function that reports a check that failed
+void testFail(const char *what, const char *fmt, ...)
+{
+    va_list ap;
+
+    printf("FAIL %s: ", what);
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    printf("\n");
+    test_failed++;
+}
+
+// function that writes line 'i' of a file generated with 'tag' to 'buf', returns its length
+int testLine(char *buf, int i, const char *tag)
+{
+    return sprintf(buf, "%s line %d of a file large enough to be mapped", tag, i);
+}
+
+// function that writes a file of 'lines' generated lines
+void testWrite(const char *path, int lines, const char *tag)
+{
+    char line[128];
+    FILE *fp = fopen(path, "w");
+
+    for(int i = 0; i < lines; i++)
+        fprintf(fp, "%.*s\n", testLine(line, i, tag), line);
+    fclose(fp);
+}
+
+// function that checks that row 'at' is generated line 'i', returns 0 if it is not
+int testRow(const char *what, int at, int i, const char *tag)
+{
+    char line[128];
+    erow *row = editorRowAt(at);
+    int len = testLine(line, i, tag);
+
+    if(row == NULL)
+    {
+        testFail(what, "row %d is missing", at);
+        return 0;
+    }
+    char *chars = malloc(row->size + 1);
+    editorRowCopy(row, 0, row->size, chars);
+    int same = row->size == len && !memcmp(chars, line, len);
+    if(!same)
+        testFail(what, "row %d is \"%.*s\"", at, row->size, chars);
+    free(chars);
+    return same;
+}
+
+/* function that checks that rows from 'from' on are the generated lines,
+    row 'from' being line 'first' */
+void testRows(const char *what, int from, int first, int lines, const char *tag)
+{
+    if(E.numrows - from != lines - first)
+    {
+        testFail(what, "%d rows, want %d", E.numrows - from, lines - first);
+        return;
+    }
+    for(int i = first; i < lines; i++)
+        if(!testRow(what, from + i - first, i, tag))
+            break;
+}
+
+/* function that runs 'child' in another process on 'path' and lets it
+    through the lease, returns 1 if the editor heard the lease break */
+int testWriter(const char *what, void (*child)(const char *), const char *path)
+{
+    pid_t pid = fork();
+    int status, broke = 0;
+
+    if(pid == 0)
+    {
+        child(path);
+        _exit(0);
+    }
+    // the child waits on the open until the mapping is copied
+    struct pollfd pfd = { E.sigfd, POLLIN, 0 };
+    if(poll(&pfd, 1, 5000) == 1)
+    {
+        struct signalfd_siginfo si;
+        while(read(E.sigfd, &si, sizeof(si)) > 0)
+            if(si.ssi_signo == SIGIO)
+            {
+                editorMapPrivate();
+                broke = 1;
+            }
+    }
+    if(!broke)
+    {
+        testFail(what, "the lease did not break");
+        kill(pid, SIGKILL);
+    }
+    waitpid(pid, &status, 0);
+    return broke;
+}
+
+// function that truncates the file to a single short line, like 'echo > file'
+void testTruncate(const char *path)
+{
+    int fd = open(path, O_WRONLY | O_TRUNC);
+
+    write(fd, "short\n", 6);
+    close(fd);
+}
+
+// function that overwrites lines in the middle and at the end of the file in place
+void testOverwrite(const char *path)
+{
+    int fd = open(path, O_WRONLY);
+    struct stat st;
+
+    fstat(fd, &st);
+    pwrite(fd, "XXXXXXXX", 8, st.st_size / 2);
+    pwrite(fd, "YYYYYYYY", 8, st.st_size - 20);
+    close(fd);
+}
+
+// function that saves the buffer and waits until the save is done
+void testSave()
+{
+    if(editorSaveStart(E.filename) == -1)
+        return;
+    while(E.save)
+    {
+        struct pollfd pfd = { E.save->wake[0], POLLIN, 0 };
+        poll(&pfd, 1, -1);
+        editorSavePoll();
+    }
+}
+
+
+/* tests */
+// function that opens 'path' fresh and checks it is mapped
+int testOpen(const char *what, const char *path, int lines, const char *tag)
+{
+    // the lease on the buffer open before would hold up writing the file
+    if(E.rows)
+        editorCloseBuffer();
+    testWrite(path, lines, tag);
+    editorOpen((char *)path);
+    if(E.map == NULL || E.mapfd == -1)
+    {
+        testFail(what, "the file is not mapped under a lease");
+        return 0;
+    }
+    return 1;
+}
+
+/* a file a writer already holds open gets no lease but is still mapped,
+    and rows read past the end it is then cut to do not kill the editor */
+void testHeld(const char *what, const char *path)
+{
+    int lines = 40000, ready[2], go[2], status;
+    char line[128], c;
+
+    if(E.rows)
+        editorCloseBuffer();
+    testWrite(path, lines, "old");
+    pipe(ready);
+    pipe(go);
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        int fd = open(path, O_WRONLY);
+        write(ready[1], "r", 1);
+        read(go[0], &c, 1);
+        ftruncate(fd, 0);
+        write(fd, line, testLine(line, 0, "new"));
+        write(fd, "\n", 1);
+        _exit(0);
+    }
+    read(ready[0], &c, 1);
+    editorOpen((char *)path);
+    if(E.map == NULL || E.mapfd != -1)
+        testFail(what, "the file is not mapped without a lease");
+    editorRowAt(0);
+    write(go[1], "g", 1);
+    waitpid(pid, &status, 0);
+    close(ready[0]);
+    close(ready[1]);
+    close(go[0]);
+    close(go[1]);
+    if(E.map == NULL)
+        return;
+
+    // the last row was never loaded and is past the end of the file now
+    erow *row = editorRowAt(lines - 1);
+    if(row == NULL || memchr(row->chars, '\0', row->size) == NULL)
+        testFail(what, "the last row does not read as zeros");
+    editorReloadCheck();
+    testRows(what, 0, 0, 1, "new");
+}
+
+// function that opens 'path' fresh as a file small enough to be read whole
+int testOpenSmall(const char *what, const char *path, int lines, const char *tag)
+{
+    if(E.rows)
+        editorCloseBuffer();
+    testWrite(path, lines, tag);
+    editorOpen((char *)path);
+    if(E.map)
+    {
+        testFail(what, "the file is mapped");
+        return 0;
+    }
+    return 1;
+}
+
+// function that checks the file watch heard of a change to the file and reloads it
+void testReload(const char *what)
+{
+    editorWatchPoll();
+    if(!E.watch_pending)
+        testFail(what, "the file watch did not hear of the change");
+    editorReloadCheck();
+}
+
+// function that checks where the cursor and the screen ended up
+void testCursor(const char *what, int cy, int cx, int rowoff)
+{
+    if(E.cy != cy || E.cx != cx || E.rowoff != rowoff)
+        testFail(what, "cursor at row %d column %d, screen at %d, want %d %d %d",
+                E.cy, E.cx, E.rowoff, cy, cx, rowoff);
+}
+
+/* lines appended to a watched file are read in as new rows, a cursor on
+    the last row follows them and one elsewhere stays */
+void testAppend(const char *what, const char *path)
+{
+    int lines = 200, more = 50;
+    char line[128];
+
+    for(int follow = 0; follow < 2; follow++)
+    {
+        if(!testOpenSmall(what, path, lines, "old"))
+            return;
+        int cy = follow ? lines - 1 : 10;
+        E.cy = cy;
+        E.cx = 3;
+        E.rowoff = follow ? lines - E.screenrows : 0;
+        FILE *fp = fopen(path, "a");
+        for(int i = lines; i < lines + more; i++)
+            fprintf(fp, "%.*s\n", testLine(line, i, "old"), line);
+        fclose(fp);
+        testReload(what);
+        if(strcmp(E.statusmsg, "File grew on disk, 50 lines read in"))
+            testFail(what, "status is \"%s\"", E.statusmsg);
+        if(E.dirty)
+            testFail(what, "the buffer is modified");
+        testRows(what, 0, 0, lines + more, "old");
+        testCursor(what, follow ? cy + more : cy, 3, follow ? lines - E.screenrows : 0);
+    }
+}
+
+/* a middle region rewritten with fewer lines only has those rows
+    replaced, the cursor and the screen below it move up with their rows */
+void testRewrite(const char *what, const char *path)
+{
+    int lines = 200;
+    char line[128];
+
+    if(!testOpenSmall(what, path, lines, "old"))
+        return;
+    E.cy = 150;
+    E.cx = 5;
+    E.rowoff = 140;
+    // lines 50 to 64 become 3 new ones
+    FILE *fp = fopen(path, "w");
+    for(int i = 0; i < lines; i++)
+    {
+        if(i >= 50 && i < 53)
+            fprintf(fp, "%.*s\n", testLine(line, i - 50, "mid"), line);
+        if(i < 50 || i >= 65)
+            fprintf(fp, "%.*s\n", testLine(line, i, "old"), line);
+    }
+    fclose(fp);
+    testReload(what);
+    if(strcmp(E.statusmsg, "File changed on disk, 15 lines reloaded"))
+        testFail(what, "status is \"%s\"", E.statusmsg);
+    if(E.numrows != lines - 12)
+        testFail(what, "%d rows, want %d", E.numrows, lines - 12);
+    for(int i = 0; i < 50 && testRow(what, i, i, "old"); i++)
+        ;
+    for(int i = 0; i < 3 && testRow(what, 50 + i, i, "mid"); i++)
+        ;
+    testRows(what, 53, 65, lines, "old");
+    testCursor(what, 138, 5, 128);
+}
+
+/* a modified buffer keeps the file as it was opened, whatever happens to
+    it, and saving it writes the buffer */
+void testModified(const char *what, const char *path, void (*child)(const char *))
+{
+    int lines = 40000;
+
+    if(!testOpen(what, path, lines, "old"))
+        return;
+    // only the first rows are loaded before the file changes
+    editorRowAt(0);
+    editorInsertRow(0, "new first line", 14);
+    if(!testWriter(what, child, path))
+        return;
+    editorReloadCheck();
+    if(strncmp(E.statusmsg, "File changed on disk!", 21))
+        testFail(what, "status is \"%s\"", E.statusmsg);
+    testRows(what, 1, 0, lines, "old");
+
+    testSave();
+    editorOpen((char *)path);
+    erow *row = editorRowAt(0);
+    if(row == NULL || row->size != 14 || memcmp(row->chars, "new first line", 14))
+        testFail(what, "the saved file does not start with the new line");
+    testRows(what, 1, 0, lines, "old");
+}
+
+/* an unmodified buffer keeps the rows it loaded through the lease breaking,
+    and is opened again once the file changed */
+void testUnmodified(const char *what, const char *path)
+{
+    int lines = 40000;
+    char line[128];
+
+    if(!testOpen(what, path, lines, "old"))
+        return;
+    erow *row = editorRowAt(0);
+    if(!testWriter(what, testTruncate, path))
+        return;
+    int len = testLine(line, 0, "old");
+    if(row->size != len || memcmp(row->chars, line, len) || row->render != row->chars)
+        testFail(what, "the loaded row changed with the file");
+    editorReloadCheck();
+    row = editorRowAt(0);
+    if(E.numrows != 1 || row->size != 5 || memcmp(row->chars, "short", 5))
+        testFail(what, "the truncated file is not opened again");
+    testWrite(path, lines, "new");
+    editorReloadCheck();
+    testRows(what, 0, 0, lines, "new");
+}
+
+int main(int argc, char *argv[])
+{
+    char path[4096];
+
+    // set up just enough of the editor to load and save a buffer without a terminal
+    E.hl_gen = 1;
+    E.hlcp_damage = -1;
+    E.screenrows = 24;
+    E.screencols = 80;
+    E.mapfd = E.watchwd = E.recordfd = E.statsfd = -1;
+    editorInitEvents();
+    snprintf(path, sizeof(path), "%s/kilo-reload-%d.txt", argc >= 2 ? argv[1] : "/tmp",
+            (int)getpid());
+
+    testModified("truncated", path, testTruncate);
+    testModified("rewritten in place", path, testOverwrite);
+    testUnmodified("unmodified", path);
+    testHeld("held open for writing", path);
+    testAppend("appended to", path);
+    testRewrite("rewritten in the middle", path);
+
+    unlink(path);
+    printf("%s\n", test_failed ? "failed" : "ok");
+    return test_failed != 0;
+}